@@ -0,0 +1,108 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// thin wrappers of OpenMP,
+// which degrade to a single thread without it,
+// and atomic operations on ints
+//
+
+#ifndef SRC_COMMON_PARALLEL_H_
+#define SRC_COMMON_PARALLEL_H_
+
+#if defined _OPENMP
+#include <omp.h>
+#endif
+
+#include <time.h>
+#if defined _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+// id of the calling thread, starts from 0
+inline int GetThreadId() {
+#if defined _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// # of threads the next parallel region will use
+inline int GetMaxThreads() {
+#if defined _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// 0 keeps the default(usually # of cores)
+inline void SetMaxThreads(int threads) {
+#if defined _OPENMP
+  if (threads > 0) {
+    omp_set_num_threads(threads);
+  }
+#else
+  (void)threads;
+#endif
+}
+
+// wall clock time in seconds, which clock() is not with threads
+inline double GetWallTime() {
+#if defined _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// atomic operations on an int shared between threads
+inline int AtomicLoad(const volatile int* p) {
+#if defined _MSC_VER
+  // volatile reads have acquire semantics in msvc
+  return *p;
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void AtomicStore(volatile int* p, int value) {
+#if defined _MSC_VER
+  // volatile writes have release semantics in msvc
+  *p = value;
+#else
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// return 1 if "*p" was "expected" and is replaced by "desired"
+inline int AtomicCompareExchange(volatile int* p, int expected, int desired) {
+#if defined _MSC_VER
+  return _InterlockedCompareExchange((volatile long*)p,  // NOLINT
+                                     desired, expected) == expected;
+#else
+  return __atomic_compare_exchange_n(p, &expected, desired, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// return the value before adding
+inline int AtomicFetchAdd(volatile int* p, int value) {
+#if defined _MSC_VER
+  return _InterlockedExchangeAdd((volatile long*)p, value);  // NOLINT
+#else
+  return __atomic_fetch_add(p, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+inline void YieldThread() {
+#if defined _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+#endif  // SRC_COMMON_PARALLEL_H_
@@ -45,8 +45,10 @@ class Vocabulary:
         self.clear()
         fp = open(filename, 'r')
         for k in fp.readlines():
-            if len(k) == 1:
+            # lines of lda-gen-corpus are "token\tcount"
+            fields = k.split()
+            if len(fields) == 0:
                 continue
-            self.add_token(k[:-1])
+            self.add_token(fields[0])
         fp.close()
         self.sort()
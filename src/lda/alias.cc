@@ -8,20 +8,27 @@ void Alias::Build(const std::vector<double>& prob, double prob_sum) {
   if (table_.size() != prob.size()) {
     table_.resize(prob.size());
     n_ = (int)prob.size();
+  }
+  Build(&prob[0], n_, prob_sum, &table_[0]);
+}
+
+void Alias::Build(const double* prob, int n, double prob_sum,
+                  AliasItem* table) {
+  if ((int)normalized_prob_.size() < n) {
     // use cached buffers
-    normalized_prob_.resize(n_);
-    small_.resize(n_);
-    large_.resize(n_);
+    normalized_prob_.resize(n);
+    small_.resize(n);
+    large_.resize(n);
   }
 
-  for (int i = 0; i < n_; ++i) {
-    normalized_prob_[i] = (prob[i] * n_) / prob_sum;
+  for (int i = 0; i < n; ++i) {
+    normalized_prob_[i] = (prob[i] * n) / prob_sum;
   }
 
   int small_begin = 0, small_end = 0;
   int large_begin = 0, large_end = 0;
 
-  for (int i = 0; i < n_; ++i) {
+  for (int i = 0; i < n; ++i) {
     if (normalized_prob_[i] < 1.0) {
       small_[small_end++] = i;
     } else {
@@ -32,7 +39,7 @@ void Alias::Build(const std::vector<double>& prob, double prob_sum) {
   while (small_begin != small_end && large_begin != large_end) {
     const int l = small_[small_begin++];
     const int g = large_[large_begin++];
-    AliasItem& item = table_[l];
+    AliasItem& item = table[l];
     item.prob = normalized_prob_[l];
     item.index = g;
     if ((normalized_prob_[g] += (item.prob - 1)) < 1.0) {
@@ -44,11 +51,11 @@ void Alias::Build(const std::vector<double>& prob, double prob_sum) {
 
   while (large_begin != large_end) {
     const int g = large_[large_begin++];
-    table_[g].prob = 1.0;
+    table[g].prob = 1.0;
   }
 
   while (small_begin != small_end) {
     const int l = small_[small_begin++];
-    table_[l].prob = 1.0;
+    table[l].prob = 1.0;
   }
 }
@@ -11,14 +11,14 @@
 
 #include "lda/rand.h"
 
+// cache friendly
+struct AliasItem {
+  double prob;
+  int index;
+};
+
 class Alias {
  private:
-  // cache friendly
-  struct AliasItem {
-    double prob;
-    int index;
-  };
-
   std::vector<AliasItem> table_;
   int n_;
   // cached data, they don't need to be member variables.
@@ -34,6 +34,9 @@ class Alias {
  public:
   Alias() : n_(0) {}
   void Build(const std::vector<double>& prob, double prob_sum);
+  // build an alias table of n items into "table" owned by the caller,
+  // which is useful to keep many small tables back to back.
+  void Build(const double* prob, int n, double prob_sum, AliasItem* table);
 
   int Sample() const {
     return Sample(Rand::Double01());
@@ -52,6 +55,15 @@ class Alias {
     const int i = (int)(u1 * n_);
     return (u2 < table_[i].prob) ? i : table_[i].index;
   }
+
+  // sample from a table built by the caller-owned version of "Build",
+  // u1 is in [0, 1)
+  static int Sample(const AliasItem* table, int n, double u1) {
+    const double un = u1 * n;
+    const int i = (int)un;
+    const double u2 = un - i;
+    return (u2 < table[i].prob) ? i : table[i].index;
+  }
 };
 
 #endif  // SRC_LDA_ALIAS_H_
@@ -2,44 +2,82 @@
 // Author: Yafei Zhang (zhangyafeikimi@gmail.com)
 //
 
+#include "common/parallel.h"
 #include "lda/rand.h"
 #include "lda/sampler.h"
 
+double AliasLDASampler::SamplerBytes(double word_nnz) const {
+  return q_proposal_.EstimateBytes(V_, K_, word_nnz) + K_ * sizeof(double);
+}
+
+int AliasLDASampler::LimitSamplerBytes(double bytes, double word_nnz) {
+  return q_proposal_.LimitBytes(V_, K_, word_nnz, bytes - K_ * sizeof(double));
+}
+
 int AliasLDASampler::InitializeSampler() {
   p_pdf_.resize(K_);
-  q_sums_.resize(V_);
-  q_samples_.resize(V_);
-  q_pdf_.resize(K_);
   if (mh_step_ == 0) {
     mh_step_ = 8;
   }
+  q_proposal_.Init(&words_topics_count_, &topics_count_, &hp_alpha_,
+                   &hp_beta_, &hp_sum_beta_,
+                   corpus_, V_, K_, K_ * mh_step_);
   return 0;
 }
 
+void AliasLDASampler::SampleCorpus() {
+  const int builders = q_proposal_.builders();
+  q_proposal_.BeginIteration();
+  if (builders == 0) {
+    SamplerBase::SampleCorpus();
+    q_proposal_.EndIteration();
+  } else {
+    // thread 0 samples, the others build q ahead of it
+#pragma omp parallel num_threads(builders + 1)
+    {
+      const int id = GetThreadId();
+      if (id == 0) {
+        SamplerBase::SampleCorpus();
+        q_proposal_.EndIteration();
+      } else {
+        q_proposal_.RunBuilder(id - 1);
+      }
+    }
+  }
+}
+
+void AliasLDASampler::PreSampleDocument(int m) {
+  SamplerBase::PreSampleDocument(m);
+  q_proposal_.Advance(m);
+}
+
 void AliasLDASampler::SampleDocument(int m) {
-  const Doc& doc = docs_[m];
-  Word* word = &words_[doc.index];
-  IntTable& doc_m_topics_count = docs_topics_count_[m];
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &doc_words_);
+  Topic* topic = &topics_[doc.index];
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
   int s, t;
   // Macro SMOLA_ALIAS_LDA implements the pure algorithm from
   // Alex Smola's paper. Otherwise,
   // some of my changes are made to make it easier and faster.
   // #define SMOLA_ALIAS_LDA
 #if defined SMOLA_ALIAS_LDA
-  int N_ms, N_vs, N_s, N_mt, N_vt, N_t;
+  int N_ms, N_vs, N_mt, N_vt;
+  TokenIndex N_s, N_t;
 #endif
-  int N_ms_prime, N_vs_prime, N_s_prime;
-  int N_mt_prime, N_vt_prime, N_t_prime;
+  int N_ms_prime, N_vs_prime, N_mt_prime, N_vt_prime;
+  TokenIndex N_s_prime, N_t_prime;
   double hp_alpha_s, hp_alpha_t;
   double accept_rate;
   double temp_s, temp_t;
   double p_sum, q_sum;
   double sample;
 
-  for (int n = 0; n < doc.N; n++, word++) {
-    const int v = word->v;
+  for (int n = 0; n < doc.N; n++, word++, topic++) {
+    const int v = *word;
     IntTable& word_v_topics_count = words_topics_count_[v];
-    const int old_k = word->k;
+    const int old_k = *topic;
     s = old_k;
 
     N_ms_prime = --doc_m_topics_count[s];
@@ -67,61 +105,7 @@ void AliasLDASampler::SampleDocument(int m) {
     }
 
     // prepare samples from q: second part of the proposal
-    q_sum = 0.0;
-    std::vector<int>& word_v_q_samples = q_samples_[v];
-    const int word_v_q_samples_size = (int)word_v_q_samples.size();
-    if (word_v_q_samples_size < mh_step_) {
-      // construct q
-      if (storage_type_ == kSparseHist) {
-        q_pdf_.assign(K_, 0.0);
-        IntTable::const_iterator first = word_v_topics_count.begin();
-        IntTable::const_iterator last = word_v_topics_count.end();
-        for (; first != last; ++first) {
-          const int k = first.id();
-          double& pdf = q_pdf_[k];
-          pdf = hp_alpha_[k]
-                * (word_v_topics_count[k] + hp_beta_)
-                / (topics_count_[k] + hp_sum_beta_);
-          q_sum += pdf;
-        }
-        for (int k = 0; k < K_; k++) {
-          double& pdf = q_pdf_[k];
-          if (pdf == 0.0) {
-            pdf = hp_alpha_[k]
-                  * hp_beta_
-                  / (topics_count_[k] + hp_sum_beta_);
-            q_sum += pdf;
-          }
-        }
-      } else {
-        // kDenseHist or kArrayBufHist
-        for (int k = 0; k < K_; k++) {
-          double& pdf = q_pdf_[k];
-          pdf = hp_alpha_[k]
-                * (word_v_topics_count[k] + hp_beta_)
-                / (topics_count_[k] + hp_sum_beta_);
-          q_sum += pdf;
-        }
-      }
-#if defined SMOLA_ALIAS_LDA
-      double& pdf_s = q_pdf_[s];
-      q_sum -= pdf_s;
-      pdf_s = hp_alpha_s
-              * (N_vs + hp_beta_)
-              / (N_s + hp_sum_beta_);
-      q_sum += pdf_s;
-#endif
-      q_sums_[v] = q_sum;
-      q_alias_table_.Build(q_pdf_, q_sum);
-
-      const int cached_samples = K_ * mh_step_;
-      word_v_q_samples.reserve(cached_samples);
-      for (int i = word_v_q_samples_size; i < cached_samples; i++) {
-        word_v_q_samples.push_back(q_alias_table_.Sample());
-      }
-    } else {
-      q_sum = q_sums_[v];
-    }
+    q_sum = q_proposal_.Prepare(v, mh_step_);
 
     for (int step = 0; step < mh_step_; step++) {
       sample = Rand::Double01() * (p_sum + q_sum);
@@ -139,8 +123,7 @@ void AliasLDASampler::SampleDocument(int m) {
         t = first.id();
       } else {
         // sample from q
-        t = word_v_q_samples.back();
-        word_v_q_samples.pop_back();
+        t = q_proposal_.Sample(v);
       }
 
       if (s != t) {
@@ -175,7 +158,7 @@ void AliasLDASampler::SampleDocument(int m) {
           / (N_mt_prime + hp_alpha_t) / temp_t;
 #endif
         if (/*accept_rate >= 1.0 || */Rand::Double01() < accept_rate) {
-          word->k = t;
+          *topic = (Topic)t;
           s = t;
 #if defined SMOLA_ALIAS_LDA
           N_ms = N_mt;
@@ -0,0 +1,134 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <assert.h>
+#include <stdlib.h>
+#if defined __linux__
+#include <sys/mman.h>
+#endif
+#include "common/parallel.h"
+#include "common/x.h"
+#include "lda/arena.h"
+
+namespace {
+
+const size_t kBlockBytes = 32 * 1048576;
+const size_t kHugePageBytes = 2 * 1048576;
+
+}  // namespace
+
+Arena::Arena(int huge_pages, int shards)
+  : huge_pages_(huge_pages), shards_(shards < 1 ? 1 : shards) {
+  for (size_t i = 0; i < shards_.size(); i++) {
+    Shard* shard = &shards_[i];
+    shard->cur = NULL;
+    shard->left = 0;
+    for (int c = 0; c < kClasses; c++) {
+      shard->free_lists[c] = NULL;
+    }
+    shard->reserved = 0;
+    shard->allocated = 0;
+  }
+}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < shards_.size(); i++) {
+    const std::vector<void*>& blocks = shards_[i].blocks;
+    for (size_t j = 0; j < blocks.size(); j++) {
+      free(blocks[j]);
+    }
+  }
+}
+
+Arena::Shard* Arena::GetShard() {
+  if (shards_.size() == 1) {
+    return &shards_[0];
+  }
+  const int id = GetThreadId();
+  assert(id < (int)shards_.size());
+  return &shards_[id];
+}
+
+void* Arena::Allocate(int c) {
+  assert(c >= 0 && c < kClasses);
+  const size_t bytes = ClassBytes(c);
+  Shard* shard = GetShard();
+  shard->allocated += bytes;
+
+  FreeNode* node = shard->free_lists[c];
+  if (node) {
+    shard->free_lists[c] = node->next;
+    return node;
+  }
+
+  if (bytes > kBlockBytes) {
+    // a dedicated block
+    return AllocateBlock(shard, bytes);
+  }
+
+  if (shard->left < bytes) {
+    // the rest of the last block is wasted,
+    // which is less than a class of the largest row so far
+    shard->cur = (char*)AllocateBlock(shard, kBlockBytes);
+    shard->left = kBlockBytes;
+  }
+  void* p = shard->cur;
+  shard->cur += bytes;
+  shard->left -= bytes;
+  return p;
+}
+
+void Arena::Free(void* p, int c) {
+  assert(c >= 0 && c < kClasses);
+  Shard* shard = GetShard();
+  FreeNode* node = (FreeNode*)p;
+  node->next = shard->free_lists[c];
+  shard->free_lists[c] = node;
+  shard->allocated -= ClassBytes(c);
+}
+
+size_t Arena::reserved() const {
+  size_t bytes = 0;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    bytes += shards_[i].reserved;
+  }
+  return bytes;
+}
+
+size_t Arena::used() const {
+  size_t bytes = 0;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    bytes += shards_[i].reserved - shards_[i].left;
+  }
+  return bytes;
+}
+
+size_t Arena::allocated() const {
+  size_t bytes = 0;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    bytes += shards_[i].allocated;
+  }
+  return bytes;
+}
+
+void* Arena::AllocateBlock(Shard* shard, size_t bytes) {
+  void* p = NULL;
+#if defined __linux__
+  if (huge_pages_) {
+    if (posix_memalign(&p, kHugePageBytes, bytes) != 0) {
+      Error("posix_memalign %d bytes failed.\n", (int)bytes);
+      exit(120);
+    }
+#if defined MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+  }
+#endif
+  if (p == NULL) {
+    p = xmalloc(bytes);
+  }
+  shard->blocks.push_back(p);
+  shard->reserved += bytes;
+  return p;
+}
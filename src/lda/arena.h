@@ -0,0 +1,90 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// a slab allocator for rows of count tables
+//
+
+#ifndef SRC_LDA_ARENA_H_
+#define SRC_LDA_ARENA_H_
+
+#include <stddef.h>
+#include <vector>
+
+// An arena carving small arrays out of large blocks.
+// Sizes are rounded up to classes of power of 2 bytes,
+// and freed arrays are kept in free lists of their classes for reuse,
+// so millions of rows make neither millions of heap blocks
+// nor malloc headers.
+// Blocks are optionally backed by transparent huge pages,
+// and are all released at once when the arena is destroyed.
+// An arena of "shards" > 1 keeps blocks and free lists for each thread,
+// so that threads of an omp team may allocate and free concurrently.
+// An array freed by a thread goes to the free lists of that thread,
+// wherever it was allocated.
+class Arena {
+ private:
+  Arena(const Arena& right);
+  Arena& operator=(const Arena& right);
+
+ public:
+  enum {
+    kMinBytes = 16,
+    kClasses = 32
+  };
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  struct Shard {
+    std::vector<void*> blocks;
+    char* cur;  // free space of the last block
+    size_t left;
+    FreeNode* free_lists[kClasses];
+    size_t reserved;  // bytes of all blocks
+    // bytes handed out and not freed,
+    // may wrap around in a shard freeing arrays of others
+    size_t allocated;
+  };
+
+  int huge_pages_;
+  std::vector<Shard> shards_;
+
+ public:
+  explicit Arena(int huge_pages = 0, int shards = 1);
+  ~Arena();
+
+  // bytes of size class "c"
+  static size_t ClassBytes(int c) {
+    return (size_t)kMinBytes << c;
+  }
+
+  // the smallest size class holding "bytes"
+  static int SizeClass(size_t bytes) {
+    int c = 0;
+    while (ClassBytes(c) < bytes) {
+      c++;
+    }
+    return c;
+  }
+
+  void* Allocate(int c);
+  void Free(void* p, int c);
+
+  int shards() const {
+    return (int)shards_.size();
+  }
+
+  size_t reserved() const;
+  // bytes carved out of blocks, freed or not
+  size_t used() const;
+  size_t allocated() const;
+
+ private:
+  // shard of the calling thread
+  Shard* GetShard();
+  void* AllocateBlock(Shard* shard, size_t bytes);
+};
+
+#endif  // SRC_LDA_ARENA_H_
@@ -8,8 +8,10 @@
 #define SRC_LDA_ARRAY_H_
 
 #include <assert.h>
+#include <stdint.h>
 #include <algorithm>
 #include <vector>
+#include "lda/arena.h"
 
 // A cache-friendly array,
 // in which data are coherent in memory.
@@ -70,7 +72,7 @@ class DenseTable : public ITable<T> {
   DenseTable() {}
 
   void Init(int size) {
-    storage_.resize(size);
+    storage_.assign(size, 0);
   }
 
   virtual T Inc(int id, T count) {
@@ -194,6 +196,67 @@ class ArrayBufTable : public ITable<T> {
   }
 };
 
+// A dense table with a list of its nonzero counts,
+// which is iterated in O(nnz) instead of O(size).
+template <class T>
+class IndexedDenseTable : public ITable<T> {
+ private:
+  typedef ITable<T> ITableT;
+  std::vector<T> storage_;
+  // ids of nonzero counts in no particular order,
+  // "positions_[id]" is the index of "id" in "nonzero_ids_"
+  std::vector<int> nonzero_ids_;
+  std::vector<int> positions_;
+
+ public:
+  IndexedDenseTable() {}
+
+  void Init(int size) {
+    storage_.resize(size);
+    positions_.resize(size, -1);
+  }
+
+  virtual T Inc(int id, T count) {
+    T& r = storage_[id];
+    if (r == 0 && count != 0) {
+      positions_[id] = (int)nonzero_ids_.size();
+      nonzero_ids_.push_back(id);
+    }
+    r += count;
+    return r;
+  }
+  virtual T Dec(int id, T count) {
+    T& r = storage_[id];
+    r -= count;
+    assert(r >= 0);
+    if (r == 0 && count != 0) {
+      const int last = nonzero_ids_.back();
+      nonzero_ids_[positions_[id]] = last;
+      positions_[last] = positions_[id];
+      positions_[id] = -1;
+      nonzero_ids_.pop_back();
+    }
+    return r;
+  }
+  virtual T Count(int id) const {
+    return storage_[id];
+  }
+  virtual int NextNonZeroCountIndex(int id) const {
+    return id;
+  }
+  virtual int Size() const {
+    return (int)nonzero_ids_.size();
+  }
+  virtual int GetId(int i) const {
+    return nonzero_ids_[i];
+  }
+  virtual T GetCount(int i) const {
+    return storage_[nonzero_ids_[i]];
+  }
+};
+
+// A sparse table whose pairs are ordered by ids.
+// Its storage comes from an arena if any, or the heap.
 template <class T>
 class SparseTable : public ITable<T> {
  private:
@@ -216,31 +279,105 @@ class SparseTable : public ITable<T> {
   };
 
   const IdCountCompare compare_;
-  std::vector<IdCount> storage_;
+  Arena* arena_;
+  IdCount* storage_;
+  int size_;
+  int size_class_;  // size class of "storage_", -1 means no storage
+
+  int Capacity() const {
+    if (size_class_ < 0) {
+      return 0;
+    }
+    return (int)(Arena::ClassBytes(size_class_) / sizeof(IdCount));
+  }
+
+  static IdCount* Allocate(Arena* arena, int c) {
+    if (arena) {
+      return (IdCount*)arena->Allocate(c);
+    }
+    return (IdCount*)new char[Arena::ClassBytes(c)];
+  }
+
+  void Free() {
+    if (size_class_ < 0) {
+      return;
+    }
+    if (arena_) {
+      arena_->Free(storage_, size_class_);
+    } else {
+      delete[] (char*)storage_;
+    }
+    storage_ = NULL;
+    size_class_ = -1;
+  }
+
+  // move pairs to a storage of size class "c"
+  void Reallocate(int c) {
+    IdCount* storage = Allocate(arena_, c);
+    std::copy(storage_, storage_ + size_, storage);
+    Free();
+    storage_ = storage;
+    size_class_ = c;
+  }
 
  public:
-  SparseTable() : compare_() {}
+  SparseTable()
+    : compare_(), arena_(NULL), storage_(NULL), size_(0), size_class_(-1) {}
+
+  virtual ~SparseTable() {
+    Free();
+  }
+
+  // take storage from "arena", only before any update
+  void set_arena(Arena* arena) {
+    assert(size_class_ < 0);
+    arena_ = arena;
+  }
+
+  // move pairs to "arena" in the smallest storage fitting them
+  void MoveTo(Arena* arena) {
+    IdCount* storage = NULL;
+    int c = -1;
+    if (size_) {
+      c = Arena::SizeClass(size_ * sizeof(IdCount));
+      storage = Allocate(arena, c);
+      std::copy(storage_, storage_ + size_, storage);
+    }
+    Free();
+    arena_ = arena;
+    storage_ = storage;
+    size_class_ = c;
+  }
 
   virtual T Inc(int id, T count) {
-    typename std::vector<IdCount>::iterator it =
-      std::lower_bound(storage_.begin(), storage_.end(), id, compare_);
-    if (it != storage_.end() && it->id == id) {
+    IdCount* last = storage_ + size_;
+    IdCount* it = std::lower_bound(storage_, last, id, compare_);
+    if (it != last && it->id == id) {
       it->count += count;
       return it->count;
     } else {
-      IdCount target = {id, count};
-      storage_.insert(it, target);
+      if (size_ == Capacity()) {
+        const int i = (int)(it - storage_);
+        Reallocate(Arena::SizeClass((size_ + 1) * sizeof(IdCount)));
+        it = storage_ + i;
+        last = storage_ + size_;
+      }
+      std::copy_backward(it, last, last + 1);
+      it->id = id;
+      it->count = count;
+      size_++;
       return count;
     }
   }
   virtual T Dec(int id, T count) {
-    typename std::vector<IdCount>::iterator it =
-      std::lower_bound(storage_.begin(), storage_.end(), id, compare_);
-    if (it != storage_.end() && it->id == id) {
+    IdCount* last = storage_ + size_;
+    IdCount* it = std::lower_bound(storage_, last, id, compare_);
+    if (it != last && it->id == id) {
       assert(it->count >= count);
       it->count -= count;
       if (it->count == 0) {
-        storage_.erase(it);
+        std::copy(it + 1, last, it);
+        size_--;
         return 0;
       } else {
         return it->count;
@@ -251,9 +388,10 @@ class SparseTable : public ITable<T> {
     }
   }
   virtual T Count(int id) const {
-    typename std::vector<IdCount>::const_iterator it =
-      std::lower_bound(storage_.begin(), storage_.end(), id, compare_);
-    if (it != storage_.end() && it->id == id) {
+    const IdCount* first = storage_;
+    const IdCount* last = first + size_;
+    const IdCount* it = std::lower_bound(first, last, id, compare_);
+    if (it != last && it->id == id) {
       assert(it->count > 0);
       return it->count;
     }
@@ -262,6 +400,145 @@ class SparseTable : public ITable<T> {
   virtual int NextNonZeroCountIndex(int id) const {
     return id;
   }
+  virtual int Size() const {
+    return size_;
+  }
+  virtual int GetId(int i) const {
+    return storage_[i].id;
+  }
+  virtual T GetCount(int i) const {
+    return storage_[i].count;
+  }
+};
+
+// A sparse table whose pairs are ordered by descending counts,
+// so that scanning a cdf from the beginning stops early.
+// A pair is swapped forward or backward when its count changes,
+// and is found through an index ordered by ids.
+template <class T>
+class OrderedSparseTable : public ITable<T> {
+ private:
+  typedef ITable<T> ITableT;
+  struct IdCount {
+    int id;
+    T count;
+  };
+
+  struct IdPosition {
+    int id;
+    int position;  // index in "storage_"
+  };
+
+  struct IdPositionCompare {
+    bool operator()(const IdPosition& a, int b) const {
+      return a.id < b;
+    }
+  };
+
+  typedef typename std::vector<IdPosition>::iterator IndexIterator;
+  typedef typename std::vector<IdPosition>::const_iterator IndexConstIterator;
+
+  const IdPositionCompare compare_;
+  std::vector<IdCount> storage_;
+  std::vector<IdPosition> index_;
+
+  IndexIterator Find(int id) {
+    return std::lower_bound(index_.begin(), index_.end(), id, compare_);
+  }
+
+  // swap the pair of "moving" with the one at "j"
+  void Swap(IdPosition* moving, int j) {
+    const int i = moving->position;
+    std::swap(storage_[i], storage_[j]);
+    Find(storage_[i].id)->position = i;
+    moving->position = j;
+  }
+
+  // first index in [first, last) whose count is less than "count",
+  // or not greater than it if "inclusive"
+  int Search(int first, int last, T count, int inclusive) const {
+    while (first < last) {
+      const int middle = (first + last) / 2;
+      const T c = storage_[middle].count;
+      if (c > count || (!inclusive && c == count)) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+    return first;
+  }
+
+  // move the pair of "moving" forward after its count grows
+  void MoveForward(IdPosition* moving) {
+    int i;
+    while ((i = moving->position) > 0
+           && storage_[i - 1].count < storage_[i].count) {
+      // swap with the first pair of the run of the previous count
+      Swap(moving, Search(0, i - 1, storage_[i - 1].count, 1));
+    }
+  }
+
+  // move the pair of "moving" backward after its count drops
+  void MoveBackward(IdPosition* moving) {
+    const int size = (int)storage_.size();
+    int i;
+    while ((i = moving->position) + 1 < size
+           && storage_[i + 1].count > storage_[i].count) {
+      // swap with the last pair of the run of the next count
+      Swap(moving, Search(i + 1, size, storage_[i + 1].count, 0) - 1);
+    }
+  }
+
+ public:
+  OrderedSparseTable() : compare_() {}
+
+  virtual T Inc(int id, T count) {
+    IndexIterator it = Find(id);
+    if (it != index_.end() && it->id == id) {
+      storage_[it->position].count += count;
+      MoveForward(&*it);
+      return storage_[it->position].count;
+    } else {
+      IdPosition position = {id, (int)storage_.size()};
+      it = index_.insert(it, position);
+      IdCount target = {id, count};
+      storage_.push_back(target);
+      MoveForward(&*it);
+      return count;
+    }
+  }
+  virtual T Dec(int id, T count) {
+    IndexIterator it = Find(id);
+    if (it != index_.end() && it->id == id) {
+      assert(storage_[it->position].count >= count);
+      storage_[it->position].count -= count;
+      MoveBackward(&*it);
+      const T r = storage_[it->position].count;
+      if (r == 0) {
+        // a zero count has been moved to the end
+        assert(it->position == (int)storage_.size() - 1);
+        storage_.pop_back();
+        index_.erase(it);
+      }
+      return r;
+    } else {
+      assert(0);
+      return -1;
+    }
+  }
+  virtual T Count(int id) const {
+    IndexConstIterator it =
+      std::lower_bound(index_.begin(), index_.end(), id, compare_);
+    if (it != index_.end() && it->id == id) {
+      assert(storage_[it->position].count > 0);
+      return storage_[it->position].count;
+    }
+    return 0;
+  }
+  virtual int NextNonZeroCountIndex(int id) const {
+    return id;
+  }
   virtual int Size() const {
     return (int)storage_.size();
   }
@@ -273,19 +550,150 @@ class SparseTable : public ITable<T> {
   }
 };
 
+// A sparse table keeping its first "N" (id, count) pairs inline,
+// which spills to the heap only when it grows beyond them.
+// With the default "N", an int table fits in one cache line,
+// and rows of short documents need no allocation at all.
+template <class T, int N = 6>
+class InlineSparseTable : public ITable<T> {
+ private:
+  typedef ITable<T> ITableT;
+  struct IdCount {
+    int id;
+    T count;
+  };
+
+  int size_;
+  int capacity_;  // "N" means inline
+  union {
+    IdCount inline_[N];
+    IdCount* heap_;
+  };
+
+  IdCount* data() {
+    return capacity_ == N ? inline_ : heap_;
+  }
+  const IdCount* data() const {
+    return capacity_ == N ? inline_ : heap_;
+  }
+  // index of the first pair whose id is not less than "id"
+  int Find(int id) const {
+    const IdCount* p = data();
+    if (size_ > N) {
+      int first = 0;
+      int last = size_;
+      while (first < last) {
+        const int middle = (first + last) / 2;
+        if (p[middle].id < id) {
+          first = middle + 1;
+        } else {
+          last = middle;
+        }
+      }
+      return first;
+    }
+    int i = 0;
+    while (i < size_ && p[i].id < id) {
+      i++;
+    }
+    return i;
+  }
+
+ public:
+  InlineSparseTable() : size_(0), capacity_(N) {}
+
+  virtual ~InlineSparseTable() {
+    if (capacity_ != N) {
+      delete[] heap_;
+    }
+  }
+
+  // drop all pairs, keeping the capacity
+  void Clear() {
+    size_ = 0;
+  }
+
+  virtual T Inc(int id, T count) {
+    const int i = Find(id);
+    IdCount* p = data();
+    if (i < size_ && p[i].id == id) {
+      p[i].count += count;
+      return p[i].count;
+    }
+
+    if (size_ == capacity_) {
+      IdCount* heap = new IdCount[capacity_ * 2];
+      std::copy(p, p + size_, heap);
+      if (capacity_ != N) {
+        delete[] heap_;
+      }
+      heap_ = heap;
+      capacity_ *= 2;
+      p = heap;
+    }
+    std::copy_backward(p + i, p + size_, p + size_ + 1);
+    p[i].id = id;
+    p[i].count = count;
+    size_++;
+    return count;
+  }
+  virtual T Dec(int id, T count) {
+    const int i = Find(id);
+    IdCount* p = data();
+    if (i < size_ && p[i].id == id) {
+      assert(p[i].count >= count);
+      p[i].count -= count;
+      if (p[i].count == 0) {
+        std::copy(p + i + 1, p + size_, p + i);
+        size_--;
+        return 0;
+      } else {
+        return p[i].count;
+      }
+    } else {
+      assert(0);
+      return -1;
+    }
+  }
+  virtual T Count(int id) const {
+    const int i = Find(id);
+    const IdCount* p = data();
+    if (i < size_ && p[i].id == id) {
+      assert(p[i].count > 0);
+      return p[i].count;
+    }
+    return 0;
+  }
+  virtual int NextNonZeroCountIndex(int id) const {
+    return id;
+  }
+  virtual int Size() const {
+    return size_;
+  }
+  virtual int GetId(int i) const {
+    return data()[i].id;
+  }
+  virtual T GetCount(int i) const {
+    return data()[i].count;
+  }
+};
+
 template <class T>
 class Table {
  private:
   typedef ITable<T> ITableT;
   typedef DenseTable<T> DenseTableT;
   typedef ArrayBufTable<T> ArrayBufTableT;
+  typedef IndexedDenseTable<T> IndexedDenseTableT;
   typedef SparseTable<T> SparseTableT;
+  typedef OrderedSparseTable<T> OrderedSparseTableT;
   ITableT* impl_;
+  bool own_impl_;
 
  public:
-  Table() : impl_(NULL) {}
+  Table() : impl_(NULL), own_impl_(true) {}
 
-  Table(const Table& right) : impl_(NULL) {
+  Table(const Table& right) : impl_(NULL), own_impl_(true) {
     // disable actual copy
     assert(right.impl_ == NULL);
   }
@@ -298,7 +706,9 @@ class Table {
   }
 
   ~Table() {
-    delete impl_;
+    if (own_impl_) {
+      delete impl_;
+    }
   }
 
   void InitDense(int size) {
@@ -311,10 +721,26 @@ class Table {
     impl_ = new ArrayBufTableT(storage, size);
   }
 
+  void InitIndexedDense(int size) {
+    IndexedDenseTableT* hist = new IndexedDenseTableT();
+    hist->Init(size);
+    impl_ = hist;
+  }
+
   void InitSparse() {
     impl_ = new SparseTableT();
   }
 
+  void InitOrderedSparse() {
+    impl_ = new OrderedSparseTableT();
+  }
+
+  // "impl" is owned by the caller
+  void InitExternal(ITableT* impl) {
+    impl_ = impl;
+    own_impl_ = false;
+  }
+
  public:
   class const_iterator {
    private:
@@ -397,13 +823,18 @@ class Table {
 enum TableType {
   kDenseHist = 1,
   kArrayBufHist,
-  kSparseHist
+  kSparseHist,
+  kInlineSparseHist,
+  kIndexedDenseHist,
+  kOrderedSparseHist
 };
 
 template <class T>
 class Tables {
  public:
   typedef Table<T> TableT;
+  typedef InlineSparseTable<T> InlineSparseTableT;
+  typedef SparseTable<T> SparseTableT;
 
  private:
   Tables(const Tables& right);
@@ -414,11 +845,29 @@ class Tables {
   int d2_;
   std::vector<TableT> matrix_;
   std::vector<int> array_buf_;
+  // tables of kInlineSparseHist, coherent in memory
+  InlineSparseTableT* inline_buf_;
+  // tables of kSparseHist, coherent in memory,
+  // with their pairs in "arena_"
+  SparseTableT* sparse_buf_;
+  Arena* arena_;
+  int huge_pages_;
+  int threads_;
 
  public:
-  Tables() : d1_(0), d2_(0) {}
+  Tables()
+    : d1_(0), d2_(0), inline_buf_(NULL), sparse_buf_(NULL), arena_(NULL),
+      huge_pages_(0), threads_(1) {}
 
-  void Init(int d1, int d2, int type) {
+  ~Tables() {
+    Free();
+  }
+
+  // "huge_pages" backs the arena of kSparseHist with huge pages,
+  // "threads" > 1 lets that many threads update different rows concurrently,
+  // rows of a previous "Init" are freed
+  void Init(int d1, int d2, int type, int huge_pages = 0, int threads = 1) {
+    Free();
     d1_ = d1;
     d2_ = d2;
     matrix_.resize(d1);
@@ -432,13 +881,93 @@ class Tables {
       for (int i = 0; i < d1_; i++) {
         matrix_[i].InitArrayBuf(&array_buf_[0] + i * d2_, d2_);
       }
+    } else if (type == kInlineSparseHist) {
+      inline_buf_ = new InlineSparseTableT[d1_];
+      for (int i = 0; i < d1_; i++) {
+        matrix_[i].InitExternal(&inline_buf_[i]);
+      }
+    } else if (type == kIndexedDenseHist) {
+      for (int i = 0; i < d1_; i++) {
+        matrix_[i].InitIndexedDense(d2_);
+      }
+    } else if (type == kOrderedSparseHist) {
+      for (int i = 0; i < d1_; i++) {
+        matrix_[i].InitOrderedSparse();
+      }
     } else {
+      huge_pages_ = huge_pages;
+      threads_ = threads;
+      arena_ = new Arena(huge_pages_, threads_);
+      sparse_buf_ = new SparseTableT[d1_];
       for (int i = 0; i < d1_; i++) {
-        matrix_[i].InitSparse();
+        sparse_buf_[i].set_arena(arena_);
+        matrix_[i].InitExternal(&sparse_buf_[i]);
       }
     }
   }
 
+  // move pairs of kSparseHist tables to a new arena in the order of rows,
+  // which drops the free space left by rows that shrank or grew,
+  // then release the old arena at once
+  void Compact() {
+    if (arena_ == NULL) {
+      return;
+    }
+    Arena* arena = new Arena(huge_pages_, threads_);
+    for (int i = 0; i < d1_; i++) {
+      sparse_buf_[i].MoveTo(arena);
+    }
+    delete arena_;
+    arena_ = arena;
+  }
+
+  // bytes used in the arena of kSparseHist tables
+  size_t used() const {
+    return arena_ ? arena_->used() : 0;
+  }
+
+  // estimated bytes of a row of "type" and "d2" columns
+  // holding "nnz" nonzero counts, for planning memory before "Init"
+  static double RowBytes(int type, double nnz, int d2) {
+    // header and alignment of a heap block
+    const double kHeap = 16.0;
+    // pairs of sparse rows, whose vectors or arrays grow by doubling
+    const double pair = sizeof(int) + sizeof(T);
+    double capacity = 1.0;
+    while (capacity < nnz) {
+      capacity *= 2.0;
+    }
+
+    double bytes = sizeof(TableT);
+    if (type == kDenseHist) {
+      bytes += sizeof(DenseTable<T>) + d2 * sizeof(T) + 2 * kHeap;
+    } else if (type == kArrayBufHist) {
+      bytes += sizeof(ArrayBufTable<T>) + d2 * sizeof(T) + kHeap;
+    } else if (type == kInlineSparseHist) {
+      bytes += sizeof(InlineSparseTableT);
+      if (nnz > 6) {
+        double inline_capacity = 6.0;
+        while (inline_capacity < nnz) {
+          inline_capacity *= 2.0;
+        }
+        bytes += inline_capacity * pair + kHeap;
+      }
+    } else if (type == kIndexedDenseHist) {
+      bytes += sizeof(IndexedDenseTable<T>)
+               + d2 * (sizeof(T) + sizeof(int)) + capacity * sizeof(int)
+               + 4 * kHeap;
+    } else if (type == kOrderedSparseHist) {
+      bytes += sizeof(OrderedSparseTable<T>)
+               + capacity * (pair + 2 * sizeof(int)) + 3 * kHeap;
+    } else {
+      bytes += sizeof(SparseTableT);
+      if (nnz > 0) {
+        bytes += Arena::ClassBytes(Arena::SizeClass((size_t)(nnz * pair)));
+      }
+    }
+    return bytes;
+  }
+
   TableT& operator[](int i) {
     return matrix_[i];
   }
@@ -446,12 +975,36 @@ class Tables {
   const TableT& operator[](int i) const {
     return matrix_[i];
   }
+
+ private:
+  void Free() {
+    matrix_.clear();
+    std::vector<int>().swap(array_buf_);
+    delete[] inline_buf_;
+    inline_buf_ = NULL;
+    delete[] sparse_buf_;
+    sparse_buf_ = NULL;
+    delete arena_;
+    arena_ = NULL;
+  }
 };
 
 typedef DenseTable<int> IntDenseTable;
 typedef ArrayBufTable<int> IntArrayBufTable;
+typedef IndexedDenseTable<int> IntIndexedDenseTable;
 typedef SparseTable<int> IntSparseTable;
+typedef OrderedSparseTable<int> IntOrderedSparseTable;
+typedef InlineSparseTable<int> IntInlineSparseTable;
 typedef Table<int> IntTable;
 typedef Tables<int> IntTables;
 
+// offset of a token in a corpus, or a count over all tokens.
+// Building with LDA_64BIT_TOKENS lifts the limit of 2^31 tokens.
+#if defined LDA_64BIT_TOKENS
+typedef int64_t TokenIndex;
+#else
+typedef int TokenIndex;
+#endif
+typedef DenseTable<TokenIndex> TokenDenseTable;
+
 #endif  // SRC_LDA_ARRAY_H_
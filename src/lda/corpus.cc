@@ -0,0 +1,83 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <string.h>
+#include <algorithm>
+#include "lda/corpus.h"
+
+void CompressedWords::Build(const std::vector<Doc>& docs,
+                            std::vector<int>* words) {
+  // sort and size all docs first to allocate bytes exactly
+  size_t size = 0;
+  size_t m;
+  for (m = 0; m < docs.size(); m++) {
+    const Doc& doc = docs[m];
+    int* begin = &(*words)[doc.index];
+    std::sort(begin, begin + doc.N);
+    int prev = 0;
+    for (int n = 0; n < doc.N; n++) {
+      unsigned int delta = (unsigned int)(begin[n] - prev);
+      prev = begin[n];
+      do {
+        size++;
+        delta >>= 7;
+      } while (delta);
+    }
+  }
+
+  std::vector<uint8_t>().swap(bytes_);
+  bytes_.reserve(size);
+  offsets_.resize(docs.size() + 1);
+  offsets_[0] = 0;
+  for (m = 0; m < docs.size(); m++) {
+    const Doc& doc = docs[m];
+    const int* begin = &(*words)[doc.index];
+    int prev = 0;
+    for (int n = 0; n < doc.N; n++) {
+      unsigned int delta = (unsigned int)(begin[n] - prev);
+      prev = begin[n];
+      while (delta >= 0x80) {
+        bytes_.push_back((uint8_t)(delta | 0x80));
+        delta >>= 7;
+      }
+      bytes_.push_back((uint8_t)delta);
+    }
+    offsets_[m + 1] = bytes_.size();
+  }
+}
+
+void CompressedWords::Decode(int m, int N, int* words) const {
+  const uint8_t* p = &bytes_[offsets_[m]];
+  int v = 0;
+  int n = 0;
+  while (n < N) {
+    // 8 words left take at least 8 bytes of this doc,
+    // decode them at once if all are one byte deltas
+    if (n + 8 <= N) {
+      uint64_t block;
+      memcpy(&block, p, sizeof(block));
+      if ((block & 0x8080808080808080ULL) == 0) {
+        words[n] = v += p[0];
+        words[n + 1] = v += p[1];
+        words[n + 2] = v += p[2];
+        words[n + 3] = v += p[3];
+        words[n + 4] = v += p[4];
+        words[n + 5] = v += p[5];
+        words[n + 6] = v += p[6];
+        words[n + 7] = v += p[7];
+        p += 8;
+        n += 8;
+        continue;
+      }
+    }
+
+    unsigned int delta = *p & 0x7f;
+    int shift = 7;
+    while (*p++ & 0x80) {
+      delta |= (unsigned int)(*p & 0x7f) << shift;
+      shift += 7;
+    }
+    words[n++] = v += (int)delta;
+  }
+}
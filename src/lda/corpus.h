@@ -0,0 +1,75 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// documents and their compressed word ids
+//
+
+#ifndef SRC_LDA_CORPUS_H_
+#define SRC_LDA_CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "lda/array.h"
+
+struct Doc {
+  TokenIndex index;  // index in "Model::words_"
+  int N;  // # of words
+};
+
+// Word ids of all docs, sorted within each doc,
+// stored as varint deltas from the previous word id of the doc.
+// Most deltas of a sorted doc fit in one byte,
+// which the decoder handles 8 at a time.
+class CompressedWords {
+ private:
+  std::vector<uint8_t> bytes_;
+  // offsets_[m]...offsets_[m + 1]: bytes of doc m in "bytes_"
+  std::vector<size_t> offsets_;
+
+ public:
+  int empty() const {
+    return offsets_.empty();
+  }
+
+  size_t bytes() const {
+    return bytes_.capacity() + offsets_.capacity() * sizeof(size_t);
+  }
+
+  // sort words of each doc in place and encode them
+  void Build(const std::vector<Doc>& docs, std::vector<int>* words);
+  // decode the "N" words of doc m to "words"
+  void Decode(int m, int N, int* words) const;
+};
+
+// tokens of all docs, read-only once loaded,
+// so that samplers may share one corpus, see "SamplerBase::ShareCorpus"
+struct Corpus {
+  // ids of all docs as '\0' terminated strings in one buffer,
+  // doc_id_offsets[m]: offset of doc m's id in "doc_id_buf",
+  // empty if docs have no ids
+  std::vector<char> doc_id_buf;
+  std::vector<size_t> doc_id_offsets;
+  std::vector<Doc> docs;
+  // words[i]: word id of token i, starts from 0,
+  // empty if they are in "compressed_words", see "DocWords"
+  std::vector<int> words;
+  CompressedWords compressed_words;
+};
+
+// word ids of doc m, in "words" if "compressed_words" is empty,
+// otherwise decoded to "buffer"
+inline const int* DocWords(const std::vector<Doc>& docs,
+                           const std::vector<int>& words,
+                           const CompressedWords& compressed_words,
+                           int m, std::vector<int>* buffer) {
+  const Doc& doc = docs[m];
+  if (compressed_words.empty()) {
+    return &words[doc.index];
+  }
+  buffer->resize(doc.N);
+  compressed_words.Decode(m, doc.N, &(*buffer)[0]);
+  return &(*buffer)[0];
+}
+
+#endif  // SRC_LDA_CORPUS_H_
@@ -0,0 +1,197 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <algorithm>
+#include "lda/rand.h"
+#include "lda/sampler.h"
+
+double FPlusLDASampler::SamplerBytes(double word_nnz) const {
+  return WordTokensBytes() + K_ * (4 * sizeof(double) + 3 * sizeof(int));
+}
+
+int FPlusLDASampler::InitializeSampler() {
+  InitializeWordTokens();
+  word_topics_count_.assign(K_, 0);
+  doc_topics_.reserve(K_);
+  doc_cdf_.reserve(K_);
+  if (large_k_) {
+    word_positions_.assign(K_, -1);
+    BuildSmoothTree();
+  } else {
+    word_pdf_.resize(K_);
+  }
+  return 0;
+}
+
+void FPlusLDASampler::PostSampleCorpus() {
+  SamplerBase::PostSampleCorpus();
+
+  if (large_k_ && HPOpt_Enabled()) {
+    BuildSmoothTree();
+  }
+}
+
+void FPlusLDASampler::BuildSmoothTree() {
+  std::vector<double> smooth_pdf(K_);
+  for (int k = 0; k < K_; k++) {
+    smooth_pdf[k] = SmoothPdf(k);
+  }
+  smooth_tree_.Build(smooth_pdf);
+}
+
+void FPlusLDASampler::SampleCorpus() {
+  // sample word by word,
+  // so that word_tree_ is built once for each word,
+  // and then updated incrementally by its tokens.
+  for (int v = 0; v < V_; v++) {
+    const TokenIndex begin = word_offsets_[v];
+    const TokenIndex end = word_offsets_[v + 1];
+    if (begin == end) {
+      continue;
+    }
+
+    LoadWord(v);
+    for (TokenIndex i = begin; i < end; i++) {
+      const TokenIndex index = word_tokens_[i];
+      SampleWordToken(token_docs_[index], v, index);
+    }
+    UnloadWord(v);
+  }
+
+  for (int m = 0; m < M_; m++) {
+    PostSampleDocument(m);
+  }
+}
+
+void FPlusLDASampler::SampleDocument(int m) {
+  // doc by doc, word_tree_ can only be reused in a run of the same word.
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &doc_words_);
+  for (int n = 0; n < doc.N;) {
+    const int v = word[n];
+    LoadWord(v);
+    do {
+      SampleWordToken(m, v, doc.index + n);
+      n++;
+    } while (n < doc.N && word[n] == v);
+    UnloadWord(v);
+  }
+}
+
+void FPlusLDASampler::LoadWord(int v) {
+  const IntTable& word_v_topics_count = words_topics_count_[v];
+  IntTable::const_iterator first = word_v_topics_count.begin();
+  IntTable::const_iterator last = word_v_topics_count.end();
+  int N_v = 0;
+  for (; first != last; ++first) {
+    const int k = first.id();
+    word_topics_count_[k] = first.count();
+    N_v += first.count();
+    if (large_k_) {
+      word_positions_[k] = (int)word_slots_.size();
+      word_slots_.push_back(k);
+    }
+  }
+
+  if (large_k_) {
+    // each token adds at most one new topic
+    const int slots = std::min(K_, (int)word_slots_.size() + N_v);
+    word_pdf_.assign(slots, 0.0);
+    for (int i = 0; i < (int)word_slots_.size(); i++) {
+      word_pdf_[i] = SparseWordPdf(word_slots_[i]);
+    }
+  } else {
+    for (int k = 0; k < K_; k++) {
+      word_pdf_[k] = WordPdf(k);
+    }
+  }
+  word_tree_.Build(word_pdf_);
+}
+
+void FPlusLDASampler::UnloadWord(int v) {
+  if (large_k_) {
+    for (int i = 0; i < (int)word_slots_.size(); i++) {
+      const int k = word_slots_[i];
+      word_topics_count_[k] = 0;
+      word_positions_[k] = -1;
+    }
+    word_slots_.clear();
+    return;
+  }
+
+  const IntTable& word_v_topics_count = words_topics_count_[v];
+  IntTable::const_iterator first = word_v_topics_count.begin();
+  IntTable::const_iterator last = word_v_topics_count.end();
+  for (; first != last; ++first) {
+    word_topics_count_[first.id()] = 0;
+  }
+}
+
+void FPlusLDASampler::SampleWordToken(int m, int v, TokenIndex index) {
+  const int old_k = topics_[index];
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+  IntTable& word_v_topics_count = words_topics_count_[v];
+
+  --topics_count_[old_k];
+  --doc_m_topics_count[old_k];
+  --word_v_topics_count[old_k];
+  --word_topics_count_[old_k];
+  UpdateTopic(old_k);
+
+  // p(k) = alpha_k * (N_vk + beta) / (N_k + sum_beta)  [word_tree_]
+  //      + N_mk * (N_vk + beta) / (N_k + sum_beta)  [doc bucket],
+  // word_tree_ and smooth_tree_ in large K mode
+  double doc_sum = 0.0;
+  doc_topics_.clear();
+  doc_cdf_.clear();
+  IntTable::const_iterator first = doc_m_topics_count.begin();
+  IntTable::const_iterator last = doc_m_topics_count.end();
+  for (; first != last; ++first) {
+    const int k = first.id();
+    doc_sum += first.count()
+               * (word_topics_count_[k] + hp_beta_)
+               / (topics_count_[k] + hp_sum_beta_);
+    doc_topics_.push_back(k);
+    doc_cdf_.push_back(doc_sum);
+  }
+
+  const double word_sum = word_tree_.sum();
+  const double smooth_sum = large_k_ ? smooth_tree_.sum() : 0.0;
+  const double sample = Rand::Double01() * (doc_sum + word_sum + smooth_sum);
+  int new_k;
+  if (sample < doc_sum) {
+    const int i = (int)(std::upper_bound(doc_cdf_.begin(), doc_cdf_.end(),
+                                         sample) - doc_cdf_.begin());
+    new_k = doc_topics_[i];
+  } else if (!large_k_) {
+    new_k = word_tree_.Sample(sample - doc_sum);
+  } else if (sample - doc_sum < word_sum) {
+    new_k = word_slots_[word_tree_.Sample(sample - doc_sum)];
+  } else {
+    new_k = smooth_tree_.Sample(sample - doc_sum - word_sum);
+  }
+
+  ++topics_count_[new_k];
+  ++doc_m_topics_count[new_k];
+  ++word_v_topics_count[new_k];
+  ++word_topics_count_[new_k];
+  UpdateTopic(new_k);
+  topics_[index] = (Topic)new_k;
+}
+
+void FPlusLDASampler::UpdateTopic(int k) {
+  if (!large_k_) {
+    word_tree_.Update(k, WordPdf(k));
+    return;
+  }
+
+  smooth_tree_.Update(k, SmoothPdf(k));
+  int& i = word_positions_[k];
+  if (i == -1) {
+    i = (int)word_slots_.size();
+    word_slots_.push_back(k);
+  }
+  word_tree_.Update(i, SparseWordPdf(k));
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "lda/ftree.h"
+
+void FTree::Build(const std::vector<double>& prob) {
+  if (size_ != (int)prob.size()) {
+    size_ = (int)prob.size();
+    n_ = 1;
+    while (n_ < size_) {
+      n_ <<= 1;
+    }
+    tree_.assign(2 * n_, 0.0);
+  }
+
+  for (int i = 0; i < size_; i++) {
+    tree_[n_ + i] = prob[i];
+  }
+  for (int i = n_ - 1; i >= 1; i--) {
+    tree_[i] = tree_[i << 1] + tree_[(i << 1) + 1];
+  }
+}
+
+void FTree::Update(int i, double prob) {
+  i += n_;
+  tree_[i] = prob;
+  // recompute sums instead of adding deltas,
+  // so that rounding errors never accumulate.
+  for (i >>= 1; i >= 1; i >>= 1) {
+    tree_[i] = tree_[i << 1] + tree_[(i << 1) + 1];
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// F+ tree, a Fenwick-like tree for sampling from
+// a dynamically changing discrete distribution
+//
+
+#ifndef SRC_LDA_FTREE_H_
+#define SRC_LDA_FTREE_H_
+
+#include <vector>
+
+#include "lda/rand.h"
+
+// A complete binary tree stored in an array.
+// Leaves hold the weights and each internal node holds
+// the sum of its two children, so that the root is the total weight.
+// Build is O(n), Update and Sample are both O(log n).
+class FTree {
+ private:
+  // tree_[1] is the root,
+  // tree_[n_ + i] is the leaf of weight i.
+  std::vector<double> tree_;
+  int n_;  // # of leaves, a power of 2
+  int size_;  // # of weights
+
+ public:
+  int size() const {
+    return size_;
+  }
+
+  double sum() const {
+    return tree_[1];
+  }
+
+  double operator[](int i) const {
+    return tree_[n_ + i];
+  }
+
+ public:
+  FTree() : n_(0), size_(0) {}
+  void Build(const std::vector<double>& prob);
+  void Update(int i, double prob);
+
+  int Sample() const {
+    return Sample(Rand::Double01() * sum());
+  }
+
+  // u is in [0, sum())
+  int Sample(double u) const {
+    int i = 1;
+    while (i < n_) {
+      const int left = i << 1;
+      if (u < tree_[left] || tree_[left + 1] <= 0.0) {
+        i = left;
+      } else {
+        u -= tree_[left];
+        i = left + 1;
+      }
+    }
+    i -= n_;
+    // rare numerical errors may lie in this branch
+    return (i < size_) ? i : size_ - 1;
+  }
+};
+
+#endif  // SRC_LDA_FTREE_H_
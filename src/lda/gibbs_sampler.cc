@@ -2,22 +2,29 @@
 // Author: Yafei Zhang (zhangyafeikimi@gmail.com)
 //
 
+#include "common/x.h"
 #include "lda/rand.h"
 #include "lda/sampler.h"
 
 int GibbsSampler::InitializeSampler() {
+  if (large_k_) {
+    Error("Gibbs sampling is O(K) for each token, without a large K mode.\n");
+    return -1;
+  }
   word_topic_cdf_.resize(K_);
   return 0;
 }
 
 void GibbsSampler::SampleDocument(int m) {
-  const Doc& doc = docs_[m];
-  Word* word = &words_[doc.index];
-  IntTable& doc_m_topics_count = docs_topics_count_[m];
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &doc_words_);
+  Topic* topic = &topics_[doc.index];
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
 
-  for (int n = 0; n < doc.N; n++, word++) {
-    const int v = word->v;
-    const int old_k = word->k;
+  for (int n = 0; n < doc.N; n++, word++, topic++) {
+    const int v = *word;
+    const int old_k = *topic;
     IntTable& word_v_topics_count = words_topics_count_[v];
     int k, new_k;
 
@@ -64,6 +71,6 @@ void GibbsSampler::SampleDocument(int m) {
     ++topics_count_[new_k];
     ++doc_m_topics_count[new_k];
     ++word_v_topics_count[new_k];
-    word->k = new_k;
+    *topic = (Topic)new_k;
   }
 }
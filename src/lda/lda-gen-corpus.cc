@@ -0,0 +1,510 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// generate lda corpus from raw text,
+// the native counterpart of lda-test-data/gen_yahoo.py
+//
+
+#include <ctype.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/city.h"
+#include "common/line-reader.h"
+#include "common/parallel.h"
+#include "common/x.h"
+#include "lda/porter_stemmer.h"
+
+// options
+std::string stop_words_filename;
+std::string file_list_filename;
+int doc_per_line = 0;
+int doc_with_id = 0;
+int stem = 1;
+int threads = 0;
+
+// An open addressing hash table of tokens and their counts,
+// ids of tokens are assigned in order of insertion.
+class TokenTable {
+ private:
+  std::vector<char> chars_;  // tokens, '\0' terminated
+  std::vector<size_t> offsets_;  // offsets_[id]: offset of token "id"
+  std::vector<uint32_t> hashes_;
+  std::vector<int64_t> counts_;
+  std::vector<int> slots_;  // ids, -1 is empty, size is a power of 2
+
+ public:
+  TokenTable() : slots_(1024, -1) {}
+
+  static uint32_t Hash(const char* token, size_t length) {
+    return CityHash32(token, length);
+  }
+
+  int size() const {
+    return (int)offsets_.size();
+  }
+
+  const char* token(int id) const {
+    return &chars_[offsets_[id]];
+  }
+
+  uint32_t hash(int id) const {
+    return hashes_[id];
+  }
+
+  int64_t count(int id) const {
+    return counts_[id];
+  }
+
+  // return the id of "token", -1 if absent
+  int Find(const char* token, size_t length, uint32_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const int id = slots_[i];
+      if (id == -1 || (hashes_[id] == hash && Equal(id, token, length))) {
+        return id;
+      }
+    }
+  }
+
+  // add "count" to "token", return its id
+  int Add(const char* token, size_t length, uint32_t hash, int64_t count) {
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    for (;; i = (i + 1) & mask) {
+      const int id = slots_[i];
+      if (id == -1) {
+        break;
+      }
+      if (hashes_[id] == hash && Equal(id, token, length)) {
+        counts_[id] += count;
+        return id;
+      }
+    }
+
+    const int id = size();
+    slots_[i] = id;
+    offsets_.push_back(chars_.size());
+    chars_.insert(chars_.end(), token, token + length);
+    chars_.push_back('\0');
+    hashes_.push_back(hash);
+    counts_.push_back(count);
+    if (offsets_.size() * 2 > slots_.size()) {
+      Grow();
+    }
+    return id;
+  }
+
+ private:
+  int Equal(int id, const char* token, size_t length) const {
+    const char* s = &chars_[offsets_[id]];
+    return strncmp(s, token, length) == 0 && s[length] == '\0';
+  }
+
+  void Grow() {
+    std::vector<int> slots(slots_.size() * 2, -1);
+    const size_t mask = slots.size() - 1;
+    for (int id = 0; id < size(); id++) {
+      size_t i = hashes_[id] & mask;
+      while (slots[i] != -1) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = id;
+    }
+    slots_.swap(slots);
+  }
+};
+
+// partition of a token by the high bits of its hash,
+// which are independent of its slot in a table
+inline int Partition(uint32_t hash, int partitions) {
+  return (int)(((uint64_t)hash * partitions) >> 32);
+}
+
+// the state of a thread
+struct Shard {
+  TokenTable tokens;
+  PorterStemmer stemmer;
+  std::vector<char> word;  // the current word
+  std::vector<int> doc;  // token ids of the current doc
+  std::vector<int> pairs;  // (token id, count) of the current doc
+  // nonempty docs of the shard as (line number, # of pairs, pairs),
+  // in the order of files the shard processed
+  std::string tmp_filename;
+  FILE* tmp;
+  std::vector<int> ids;  // ids[i]: global id of token i
+  Shard() : tmp(NULL) {}
+};
+
+TokenTable stop_words;
+
+void AddWord(Shard* shard) {
+  std::vector<char>& word = shard->word;
+  int length = (int)word.size();
+  if (stop_words.size()
+      && stop_words.Find(&word[0], length,
+                         TokenTable::Hash(&word[0], length)) != -1) {
+    word.clear();
+    return;
+  }
+
+  if (stem) {
+    length = shard->stemmer.Stem(&word[0], length);
+  }
+  const uint32_t hash = TokenTable::Hash(&word[0], length);
+  // gen_yahoo.py checks stop words after stemming
+  if (stop_words.size() && stop_words.Find(&word[0], length, hash) != -1) {
+    word.clear();
+    return;
+  }
+  shard->doc.push_back(shard->tokens.Add(&word[0], length, hash, 1));
+  word.clear();
+}
+
+// write the current doc on line "line_no" of its file,
+// return 1 if it is written, 0 if it is empty and dropped
+int FlushDoc(Shard* shard, int line_no) {
+  std::vector<int>& doc = shard->doc;
+  std::vector<int>& pairs = shard->pairs;
+  std::sort(doc.begin(), doc.end());
+  pairs.clear();
+  for (size_t i = 0; i < doc.size();) {
+    size_t j = i + 1;
+    while (j < doc.size() && doc[j] == doc[i]) {
+      j++;
+    }
+    pairs.push_back(doc[i]);
+    pairs.push_back((int)(j - i));
+    i = j;
+  }
+
+  doc.clear();
+  // lda-train drops empty lines,
+  // which would shift docs after them in its output
+  const int n = (int)pairs.size() / 2;
+  if (n == 0) {
+    return 0;
+  }
+  xfwrite(&line_no, sizeof(line_no), 1, shard->tmp);
+  xfwrite(&n, sizeof(n), 1, shard->tmp);
+  xfwrite(&pairs[0], sizeof(pairs[0]), pairs.size(), shard->tmp);
+  return 1;
+}
+
+// tokenize a file into docs of the shard, return # of nonempty docs
+int ProcessFile(const char* filename, Shard* shard) {
+  ScopedFile fp(filename, ScopedFile::ReadBinary);
+  std::vector<char> buf(1048576);
+  std::vector<char>& word = shard->word;
+  int docs = 0;
+  int line_no = 1;
+  int line_open = 0;  // some characters follow the last '\n'
+  size_t size;
+
+  while ((size = fread(&buf[0], 1, buf.size(), fp)) != 0) {
+    for (size_t i = 0; i < size; i++) {
+      const int c = (unsigned char)buf[i];
+      if (isalpha(c)) {
+        word.push_back((char)tolower(c));
+        line_open = 1;
+        continue;
+      }
+
+      if (!word.empty()) {
+        AddWord(shard);
+      }
+      if (doc_per_line && c == '\n') {
+        docs += FlushDoc(shard, line_no++);
+        line_open = 0;
+      } else {
+        line_open = 1;
+      }
+    }
+  }
+
+  if (!word.empty()) {
+    AddWord(shard);
+  }
+  if (!doc_per_line || line_open) {
+    docs += FlushDoc(shard, line_no);
+  }
+  return docs;
+}
+
+struct TokenLess {
+  const std::vector<TokenTable>* parts;
+  explicit TokenLess(const std::vector<TokenTable>* p) : parts(p) {}
+  bool operator()(const std::pair<int, int>& a,
+                  const std::pair<int, int>& b) const {
+    return strcmp((*parts)[a.first].token(a.second),
+                  (*parts)[b.first].token(b.second)) < 0;
+  }
+};
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: lda-gen-corpus [options] OUTPUT_PREFIX [INPUT_FILE]...\n"
+          "  OUTPUT_PREFIX: output filename prefix,\n"
+          "    \"OUTPUT_PREFIX-train\" is the corpus of \"word_id:count\",\n"
+          "    documents without words are dropped,\n"
+          "    \"OUTPUT_PREFIX-vocab\" has lines of \"word<TAB>count\",\n"
+          "    the word on line i is word i.\n"
+          "  INPUT_FILE: input raw text filename.\n"
+          "\n"
+          "  Options:\n"
+          "    -file_list FILE\n"
+          "      Also read input filenames from FILE, one per line.\n"
+          "    -stop_words FILE\n"
+          "      Stop words, one per line.\n"
+          "    -doc_per_line 0/1\n"
+          "      0, each file is a document; 1, each line is a document.\n"
+          "      Default is \"%d\".\n"
+          "    -doc_with_id 0/1\n"
+          "      Start each line of \"OUTPUT_PREFIX-train\" with a doc ID,\n"
+          "      \"FILE_NO\" or \"FILE_NO-LINE_NO\"(doc_per_line),\n"
+          "      both starting from 1, FILE_NO in the order of inputs,\n"
+          "      for lda-train -doc_with_id 1.\n"
+          "      Default is \"%d\".\n"
+          "    -stem 0/1\n"
+          "      Stem words by Porter stemmer.\n"
+          "      Default is \"%d\".\n"
+          "    -threads THREADS\n"
+          "      Number of threads. 0 uses all cores.\n"
+          "      Default is \"%d\".\n",
+          doc_per_line,
+          doc_with_id,
+          stem,
+          threads);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  if (argc == 1) {
+    Usage();
+  }
+
+  int i = 1;
+  for (;;) {
+    std::string s = argv[i];
+    if (s == "-h" || s == "-help" || s == "--help") {
+      Usage();
+    }
+
+    if (strncmp(s.c_str(), "--", 2) == 0) {
+      s.erase(s.begin());
+    }
+
+    if (s == "-file_list") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      file_list_filename = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stop_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      stop_words_filename = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-doc_per_line") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      doc_per_line = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-doc_with_id") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      doc_with_id = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stem") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      stem = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else {
+      i++;
+    }
+    if (i == argc) {
+      break;
+    }
+  }
+
+  if (argc == 1) {
+    Usage();
+  }
+
+#define CHECK_EXIT(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "Must have: %s\n", #condition); \
+      exit(1); \
+    } \
+  } while (0)
+
+  CHECK_EXIT(doc_per_line >= 0 && doc_per_line <= 1);
+  CHECK_EXIT(doc_with_id >= 0 && doc_with_id <= 1);
+  CHECK_EXIT(stem >= 0 && stem <= 1);
+  CHECK_EXIT(threads >= 0);
+
+  const std::string output_prefix = argv[1];
+  std::vector<std::string> filenames(argv + 2, argv + argc);
+  LineReader line_reader;
+  if (!file_list_filename.empty()) {
+    ScopedFile fp(file_list_filename.c_str(), ScopedFile::Read);
+    while (line_reader.ReadLine(fp) != NULL) {
+      char* filename = strtok(line_reader.buf, "\r\n");
+      if (filename) {
+        filenames.push_back(filename);
+      }
+    }
+  }
+  if (filenames.empty()) {
+    Usage();
+  }
+
+  if (!stop_words_filename.empty()) {
+    ScopedFile fp(stop_words_filename.c_str(), ScopedFile::Read);
+    while (line_reader.ReadLine(fp) != NULL) {
+      const char* word = strtok(line_reader.buf, DELIMITER "\r");
+      if (word) {
+        const size_t length = strlen(word);
+        stop_words.Add(word, length, TokenTable::Hash(word, length), 1);
+      }
+    }
+  }
+
+  // tokenize files into temporary files of shards
+  SetMaxThreads(threads);
+  const int shards_size = GetMaxThreads();
+  const int files = (int)filenames.size();
+  std::vector<Shard> shards(shards_size);
+  for (i = 0; i < shards_size; i++) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-train.tmp%d", i);
+    shards[i].tmp_filename = output_prefix + suffix;
+    shards[i].tmp = xfopen(shards[i].tmp_filename.c_str(), "wb");
+  }
+  // "owners" and "docs" of files,
+  // each shard processes its files in increasing order
+  std::vector<int> owners(files);
+  std::vector<int> docs(files);
+  Log("Tokenizing %d files with %d threads.\n", files, shards_size);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < files; i++) {
+    const int t = GetThreadId();
+    owners[i] = t;
+    docs[i] = ProcessFile(filenames[i].c_str(), &shards[t]);
+  }
+  for (i = 0; i < shards_size; i++) {
+    fclose(shards[i].tmp);
+  }
+
+  // merge tables of shards,
+  // each partition of tokens is merged by a thread
+  const int partitions = shards_size;
+  std::vector<TokenTable> parts(partitions);
+  Log("Merging vocabulary.\n");
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < partitions; i++) {
+    TokenTable& part = parts[i];
+    for (int t = 0; t < shards_size; t++) {
+      const TokenTable& tokens = shards[t].tokens;
+      for (int id = 0; id < tokens.size(); id++) {
+        const uint32_t hash = tokens.hash(id);
+        if (Partition(hash, partitions) == i) {
+          const char* token = tokens.token(id);
+          part.Add(token, strlen(token), hash, tokens.count(id));
+        }
+      }
+    }
+  }
+
+  // word ids in alphabetical order, starting from 1, like gen_yahoo.py
+  std::vector<std::pair<int, int> > order;
+  for (i = 0; i < partitions; i++) {
+    for (int id = 0; id < parts[i].size(); id++) {
+      order.push_back(std::make_pair(i, id));
+    }
+  }
+  std::sort(order.begin(), order.end(), TokenLess(&parts));
+  std::vector<std::vector<int> > part_ids(partitions);
+  for (i = 0; i < partitions; i++) {
+    part_ids[i].resize(parts[i].size());
+  }
+  int64_t total_tokens = 0;
+  {
+    const std::string filename = output_prefix + "-vocab";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (i = 0; i < (int)order.size(); i++) {
+      const TokenTable& part = parts[order[i].first];
+      const int id = order[i].second;
+      part_ids[order[i].first][id] = i + 1;
+      fprintf(fp, "%s\t%lld\n", part.token(id),
+              (long long)part.count(id));  // NOLINT
+      total_tokens += part.count(id);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < shards_size; i++) {
+    Shard& shard = shards[i];
+    const TokenTable& tokens = shard.tokens;
+    shard.ids.resize(tokens.size());
+    for (int id = 0; id < tokens.size(); id++) {
+      const char* token = tokens.token(id);
+      const uint32_t hash = tokens.hash(id);
+      const int p = Partition(hash, partitions);
+      shard.ids[id] = part_ids[p][parts[p].Find(token, strlen(token), hash)];
+    }
+  }
+
+  // translate docs in the order of files
+  int total_docs = 0;
+  {
+    const std::string filename = output_prefix + "-train";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (i = 0; i < shards_size; i++) {
+      shards[i].tmp = xfopen(shards[i].tmp_filename.c_str(), "rb");
+    }
+    std::vector<int> pairs;
+    std::vector<std::pair<int, int> > words;
+    for (int f = 0; f < files; f++) {
+      Shard& shard = shards[owners[f]];
+      for (int d = 0; d < docs[f]; d++) {
+        int line_no, n;
+        xfread(&line_no, sizeof(line_no), 1, shard.tmp);
+        xfread(&n, sizeof(n), 1, shard.tmp);
+        pairs.resize(n * 2);
+        xfread(&pairs[0], sizeof(pairs[0]), pairs.size(), shard.tmp);
+        if (doc_with_id) {
+          if (doc_per_line) {
+            fprintf(fp, "%d-%d ", f + 1, line_no);
+          } else {
+            fprintf(fp, "%d ", f + 1);
+          }
+        }
+        words.resize(n);
+        for (int j = 0; j < n; j++) {
+          words[j].first = shard.ids[pairs[j * 2]];
+          words[j].second = pairs[j * 2 + 1];
+        }
+        std::sort(words.begin(), words.end());
+        for (int j = 0; j < n; j++) {
+          fprintf(fp, j == n - 1 ? "%d:%d" : "%d:%d ",
+                  words[j].first, words[j].second);
+        }
+        fprintf(fp, "\n");
+      }
+      total_docs += docs[f];
+    }
+    for (i = 0; i < shards_size; i++) {
+      fclose(shards[i].tmp);
+      remove(shards[i].tmp_filename.c_str());
+    }
+  }
+
+  Log("Generated %d documents, %lld tokens "
+      "with a %d-size vocabulary.\n",
+      total_docs, (long long)total_tokens,  // NOLINT
+      (int)order.size());
+  return 0;
+}
@@ -4,9 +4,17 @@
 // lda tests
 //
 
+#include <time.h>
+#include <algorithm>
+#include "common/line-reader.h"
 #include "common/x.h"
 #include "lda/alias.h"
+#include "lda/corpus.h"
+#include "lda/ftree.h"
+#include "lda/numa.h"
+#include "lda/rand.h"
 #include "lda/sampler.h"
+#include "lda/scvb0.h"
 
 #if defined _WIN32
 #define TEST_DATA_DIR "../src/lda-test-data"
@@ -36,6 +44,171 @@ void TestAlias() {
   }
 }
 
+void TestFTree() {
+  std::vector<double> prob;
+  prob.push_back(0.01);
+  prob.push_back(0.07);
+  prob.push_back(0.13);
+  prob.push_back(0.29);
+  prob.push_back(0.45);
+  prob.push_back(0.05);
+
+  FTree tree;
+  tree.Build(prob);
+  // move 0.2 from the 4th weight to the 1st one
+  tree.Update(0, 0.21);
+  tree.Update(4, 0.25);
+
+  std::vector<int> count(tree.size());
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    count[tree.Sample()]++;
+  }
+  for (int i = 0; i < tree.size(); i++) {
+    printf("%lf %lf\n", tree[i], count[i] / (double)N);
+  }
+}
+
+// pinning and placement succeed on nodes read from the system,
+// fail cleanly on the fallback node, and keep contents of pages,
+// threads map onto the first min(nodes, threads) nodes in order
+void TestNuma() {
+  Numa numa;
+  numa.Load();
+  std::vector<int> buffer(1 << 20);
+  for (int i = 0; i < (int)buffer.size(); i++) {
+    buffer[i] = i;
+  }
+  int errors = 0;
+  for (int node = 0; node < numa.nodes(); node++) {
+    const int pinned = numa.PinThread(node);
+    const int placed = numa.Place(&buffer[0],
+                                  buffer.size() * sizeof(int), node);
+    // the fallback node has no system id, where both do nothing
+    const int expected = numa.node_id(node) >= 0 ? 0 : -1;
+    if (pinned != expected || placed != expected) {
+      errors++;
+    }
+    for (int i = 0; i < (int)buffer.size(); i++) {
+      if (buffer[i] != i) {
+        errors++;
+      }
+    }
+    printf("node %d of %d: pinned %d, placed %d\n",
+           node, numa.nodes(), pinned, placed);
+  }
+  for (int threads = 1; threads <= 2 * numa.nodes() + 1; threads++) {
+    const int used = std::min(numa.nodes(), threads);
+    int prev_node = 0;
+    for (int t = 0; t < threads; t++) {
+      const int node = numa.ThreadNode(t, threads);
+      if (node < prev_node || node > prev_node + 1 || node >= used) {
+        errors++;
+      }
+      prev_node = node;
+    }
+    if (prev_node != used - 1) {
+      errors++;
+    }
+  }
+  printf("%d errors\n", errors);
+}
+
+// all table types should agree with a plain array under random updates
+void TestTables() {
+  const int types[] = {
+    kDenseHist, kArrayBufHist, kSparseHist,
+    kInlineSparseHist, kIndexedDenseHist, kOrderedSparseHist
+  };
+  const int rows = 4;
+  const int K = 50;
+  for (int t = 0; t < (int)(sizeof(types) / sizeof(types[0])); t++) {
+    IntTables tables;
+    tables.Init(rows, K, types[t]);
+    std::vector<int> expected(rows * K);
+    int errors = 0;
+    for (int i = 0; i < 100000; i++) {
+      const int row = (int)Rand::UInt(rows);
+      const int k = (int)Rand::UInt(K);
+      int& count = expected[row * K + k];
+      if (count > 0 && Rand::UInt(2)) {
+        --tables[row][k];
+        count--;
+      } else {
+        ++tables[row][k];
+        count++;
+      }
+    }
+    for (int row = 0; row < rows; row++) {
+      const IntTable& table = tables[row];
+      int nnz = 0;
+      int prev_count = 0x7fffffff;
+      IntTable::const_iterator first = table.begin();
+      IntTable::const_iterator last = table.end();
+      for (; first != last; ++first, nnz++) {
+        if (first.count() != expected[row * K + first.id()]) {
+          errors++;
+        }
+        if (types[t] == kOrderedSparseHist) {
+          if (first.count() > prev_count) {
+            errors++;
+          }
+          prev_count = first.count();
+        }
+      }
+      for (int k = 0; k < K; k++) {
+        if (table[k] != expected[row * K + k]) {
+          errors++;
+        }
+        if (expected[row * K + k]) {
+          nnz--;
+        }
+      }
+      if (nnz != 0) {
+        errors++;
+      }
+    }
+    printf("type %d: %d errors\n", types[t], errors);
+  }
+}
+
+// decoded words should be the sorted words of each doc
+void TestCompressedWords() {
+  std::vector<Doc> docs;
+  std::vector<int> words;
+  for (int m = 0; m < 1000; m++) {
+    Doc doc;
+    doc.index = (TokenIndex)words.size();
+    doc.N = 1 + (int)Rand::UInt(100);
+    // mostly small ids with a few large ones, for deltas of all sizes
+    const int V = Rand::UInt(10) ? 100 : 2000000000;
+    for (int n = 0; n < doc.N; n++) {
+      words.push_back((int)Rand::UInt(V));
+    }
+    docs.push_back(doc);
+  }
+
+  std::vector<int> expected(words);
+  CompressedWords compressed;
+  compressed.Build(docs, &words);
+  std::vector<int> decoded;
+  int errors = 0;
+  for (int m = 0; m < (int)docs.size(); m++) {
+    const Doc& doc = docs[m];
+    std::sort(expected.begin() + doc.index,
+              expected.begin() + doc.index + doc.N);
+    decoded.resize(doc.N);
+    compressed.Decode(m, doc.N, &decoded[0]);
+    for (int n = 0; n < doc.N; n++) {
+      if (decoded[n] != expected[doc.index + n]) {
+        errors++;
+      }
+    }
+  }
+  printf("%d tokens in %d bytes: %d errors\n",
+         (int)words.size(), (int)compressed.bytes(), errors);
+}
+
 void TestSimple() {
   ScopedFile fp(TEST_DATA_DIR"/simple-train", ScopedFile::Read);
   LightLDASampler model;
@@ -53,9 +226,12 @@ void TestSimple() {
 void TestYahoo() {
   ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
   // GibbsSampler model;  //-83246.6/-6.99258
-  // SparseLDASampler model;  //-83226.5/-6.99089
-  // AliasLDASampler model;  // -83187.8/-6.98764
-  LightLDASampler model;  // -83292.9/-6.99647
+  // SparseLDASampler model;  //-83224.1/-6.99069
+  // AliasLDASampler model;  // -83251.6/-6.993
+  // FPlusLDASampler model;  // -83268.6/-6.99442
+  // WarpLDASampler model;  // -82696.3/-6.94635
+  // PolyaUrnLDASampler model;  // -86273.3/-7.24682(1 thread)
+  LightLDASampler model;  // -83280.8/-6.99545
   model.mh_step() = 16;
   model.LoadCorpus(fp, 0);
   model.K() = 3;
@@ -70,6 +246,275 @@ void TestYahoo() {
   model.SaveModel(TEST_DATA_DIR"/yahoo");
 }
 
+void TestYahooSCVB0() {
+  ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+  SCVB0 model;
+  model.K() = 3;
+  model.alpha() = 0.1;
+  model.beta() = 0.1;
+  model.batch_size() = 16;
+  model.Train(fp, 0, TEST_DATA_DIR"/yahoo-scvb0");
+}
+
+// # of tokens of the corpus in "filename"
+int CountTokens(const char* filename) {
+  ScopedFile fp(filename, ScopedFile::Read);
+  LineReader line_reader;
+  std::vector<int> words;
+  char* doc_id;
+  int line_no = 0;
+  int tokens = 0;
+  while (line_reader.ReadLine(fp) != NULL) {
+    line_no++;
+    tokens += ParseDoc(line_reader.buf, line_no, 0, &doc_id, &words);
+  }
+  return tokens;
+}
+
+// tokens/sec of "iterations" iterations of an initialized "model"
+// over "tokens" tokens,
+// timing sampling only, log likelihood is O(K) per token
+double TimeSampling(SamplerBase* model, int tokens, int iterations) {
+  const clock_t begin = clock();
+  for (int i = 0; i < iterations; i++) {
+    model->SampleCorpus();
+  }
+  const double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+  return (double)tokens * iterations / seconds;
+}
+
+// tokens/sec of SparseLDASampler should stay flat as K grows
+void BenchmarkSparseLDA() {
+  const int tokens = CountTokens(TEST_DATA_DIR"/yahoo-train");
+
+  const int iterations = 20;
+  for (int K = 100; K <= 100000; K *= 10) {
+    ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+    SparseLDASampler model;
+    model.LoadCorpus(fp, 0);
+    model.K() = K;
+    model.alpha() = 0.1;
+    model.beta() = 0.1;
+    model.hp_opt() = 0;
+    model.storage_type() = kSparseHist;
+    model.Initialize();
+    model.InitializeSampler();
+    printf("K=%d: %.0lf tokens/sec\n", K,
+           TimeSampling(&model, tokens, iterations));
+  }
+}
+
+// tokens/sec of samplers whose per-token work is independent of K,
+// up to 1M topics
+void BenchmarkLargeK() {
+  const int tokens = CountTokens(TEST_DATA_DIR"/yahoo-train");
+
+  const char* const names[] = {"sparselda", "warplda", "fpluslda"};
+  const int iterations = 5;
+  for (int K = 1000; K <= 1000000; K *= 10) {
+    for (int i = 0; i < 3; i++) {
+      ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+      SamplerBase* model;
+      if (i == 0) {
+        model = new SparseLDASampler;
+      } else if (i == 1) {
+        model = new WarpLDASampler;
+      } else {
+        model = new FPlusLDASampler;
+      }
+      model->LoadCorpus(fp, 0);
+      model->K() = K;
+      model->alpha() = 0.1;
+      model->beta() = 0.1;
+      model->hp_opt() = 0;
+      model->storage_type() = kSparseHist;
+      model->large_k() = 1;
+      model->Initialize();
+      model->InitializeSampler();
+      printf("K=%d, %s: %.0lf tokens/sec\n", K, names[i],
+             TimeSampling(model, tokens, iterations));
+      delete model;
+    }
+  }
+}
+
+// counts of a trained model should add up to its tokens
+class CheckedSparseLDASampler : public SparseLDASampler {
+ public:
+  int Check(int64_t tokens) const {
+    int errors = 0;
+    if ((int64_t)topics_.size() != tokens) {
+      errors++;
+    }
+    TokenIndex index = 0;
+    for (int m = 0; m < M_; m++) {
+      if (corpus_->docs[m].index != index) {
+        errors++;
+      }
+      index += corpus_->docs[m].N;
+    }
+    TokenIndex sum = 0;
+    for (int k = 0; k < K_; k++) {
+      sum += topics_count_[k];
+    }
+    if (index != tokens || sum != tokens) {
+      errors++;
+    }
+    return errors;
+  }
+};
+
+// a corpus of more than 2^31 tokens in a small file of "word_id:count",
+// it needs LDA_64BIT_TOKENS and about 20GB memory
+void TestLargeCorpus() {
+  const int M = 2200;
+  const int N = 1000000;
+  {
+    ScopedFile fp(TEST_DATA_DIR"/large-train", ScopedFile::Write);
+    for (int m = 0; m < M; m++) {
+      fprintf(fp, "%d:%d %d:%d\n", m % 100 + 1, N / 2, m % 100 + 101, N / 2);
+    }
+  }
+
+  ScopedFile fp(TEST_DATA_DIR"/large-train", ScopedFile::Read);
+  CheckedSparseLDASampler model;
+  model.LoadCorpus(fp, 0);
+  model.K() = 10;
+  model.alpha() = 0.1;
+  model.beta() = 0.1;
+  model.log_likelihood_interval() = 0;
+  model.total_iteration() = 1;
+  model.hp_opt() = 0;
+  model.storage_type() = kSparseHist;
+  model.Train();
+  const int64_t tokens = (int64_t)M * N;
+  printf("%.0lf tokens: %d errors\n", (double)tokens, model.Check(tokens));
+}
+
+// doc-topic counts, kept or implicit, should add up to topic counts
+class CheckedLightLDASampler : public LightLDASampler {
+ public:
+  int Check() {
+    std::vector<TokenIndex> sum(K_, 0);
+    int implicit_docs = 0;
+    for (int m = 0; m < M_; m++) {
+      ImplicitDocTopicsCount implicit;
+      const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+      IntTable::const_iterator first = doc_m_topics_count.begin();
+      IntTable::const_iterator last = doc_m_topics_count.end();
+      for (; first != last; ++first) {
+        sum[first.id()] += first.count();
+      }
+      if (DocRow(m) < 0) {
+        implicit_docs++;
+      }
+    }
+    int errors = 0;
+    for (int k = 0; k < K_; k++) {
+      if (sum[k] != topics_count_[k]) {
+        errors++;
+      }
+    }
+    for (size_t i = 0; i < topics_.size(); i++) {
+      if ((int)topics_[i] >= K_) {
+        errors++;
+      }
+    }
+    printf("K=%d, %d of %d docs are implicit: %d errors\n",
+           K_, implicit_docs, M_, errors);
+    return errors;
+  }
+};
+
+// yahoo-train split into docs of at most 10 tokens
+void TestImplicitDocLen() {
+  {
+    ScopedFile in(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+    ScopedFile out(TEST_DATA_DIR"/short-train", ScopedFile::Write);
+    LineReader line_reader;
+    while (line_reader.ReadLine(in) != NULL) {
+      int n = 0;
+      char* word = strtok(line_reader.buf, " \t\r\n");
+      for (; word; word = strtok(NULL, " \t\r\n")) {
+        if (n && n % 10 == 0) {
+          fprintf(out, "\n");
+        }
+        fprintf(out, n % 10 ? " %s" : "%s", word);
+        n++;
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  ScopedFile fp(TEST_DATA_DIR"/short-train", ScopedFile::Read);
+  CheckedLightLDASampler model;
+  model.LoadCorpus(fp, 0);
+  model.K() = 100;
+  model.total_iteration() = 20;
+  model.hp_opt() = 0;
+  model.implicit_doc_len() = kMaxImplicitDocLen;
+  model.Train();
+  model.Check();
+}
+
+// most of 200 topics die out on yahoo-train
+void TestCompactTopics() {
+  ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+  CheckedLightLDASampler model;
+  model.LoadCorpus(fp, 0);
+  model.K() = 200;
+  model.alpha() = 0.01;
+  model.total_iteration() = 20;
+  model.hp_opt() = 0;
+  model.compact_topics_interval() = 5;
+  model.min_topic_count() = 20;
+  model.Train();
+  model.Check();
+}
+
+// dense tables of 1000 topics exceed the limit,
+// the planner switches storage type, or refuses a tighter limit
+void TestMemoryLimit() {
+  const int limits[] = {8, 1};
+  for (int i = 0; i < 2; i++) {
+    ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+    AliasLDASampler model;
+    model.LoadCorpus(fp, 0);
+    model.K() = 1000;
+    model.log_likelihood_interval() = 0;
+    model.total_iteration() = 1;
+    model.hp_opt() = 0;
+    model.storage_type() = kDenseHist;
+    model.memory_limit() = limits[i];
+    const int ret = model.Train();
+    printf("limit %dMB: returned %d, storage type %d\n",
+           limits[i], ret, model.storage_type());
+  }
+}
+
+// a sampler sharing a corpus trains the same model as its loader,
+// given the same random stream
+void TestShareCorpus() {
+  ScopedFile fp(TEST_DATA_DIR"/yahoo-train", ScopedFile::Read);
+  SparseLDASampler models[2];
+  models[0].compress_words() = 1;
+  models[0].LoadCorpus(fp, 0);
+  models[1].ShareCorpus(models[0]);
+  double llh[2];
+  for (int i = 0; i < 2; i++) {
+    RandEngine engine;
+    Rand::SetThreadEngine(&engine);
+    models[i].K() = 50;
+    models[i].total_iteration() = 20;
+    models[i].hp_opt() = 0;
+    models[i].Train();
+    llh[i] = models[i].LogLikelihood();
+    Rand::SetThreadEngine(NULL);
+  }
+  printf("loader %lg, sharer %lg: %s\n",
+         llh[0], llh[1], llh[0] == llh[1] ? "same" : "different");
+}
+
 void TestNIPS() {
   ScopedFile fp(TEST_DATA_DIR"/nips-train", ScopedFile::Read);
   LightLDASampler model;
@@ -89,8 +534,20 @@ void TestNIPS() {
 
 int main() {
   // TestAlias();
+  // TestFTree();
+  // TestTables();
+  // TestCompressedWords();
   // TestSimple();
   TestYahoo();
+  // TestYahooSCVB0();
+  // BenchmarkSparseLDA();
+  // BenchmarkLargeK();
   // TestNIPS();
+  // TestLargeCorpus();
+  // TestMemoryLimit();
+  // TestImplicitDocLen();
+  // TestCompactTopics();
+  // TestShareCorpus();
+  // TestNuma();
   return 0;
 }
@@ -4,9 +4,15 @@
 // lda train
 //
 
+#include <algorithm>
 #include <string>
+#include <vector>
+#include "common/line-reader.h"
+#include "common/parallel.h"
 #include "common/x.h"
+#include "lda/rand.h"
 #include "lda/sampler.h"
+#include "lda/scvb0.h"
 
 // input options
 int doc_with_id;
@@ -30,11 +36,39 @@ int total_iteration = 200;
 int burnin_iteration = 10;
 int log_likelihood_interval = 10;
 int storage_type = kSparseHist;
+int huge_pages = 0;
+int compact_interval = 0;
+int compact_topics_interval = 0;
+int min_topic_count = 0;
+int sort_tokens = 0;
+int compress_words = 0;
+int memory_limit = 0;
+int implicit_doc_len = 0;
+int large_k = 0;
+int remap_words = 0;
+int min_word_count = 0;
+double max_doc_freq = 1.0;
+std::string stop_words_filename;
+
+// sweep options
+std::string sweep;
+int sweep_threads = 0;
 
 // LightLDASampler options
 int mh_step = 8;
 int enable_word_proposal = 1;
 int enable_doc_proposal = 1;
+int builders = 0;
+int proposal_memory = 0;
+
+// PolyaUrnLDASampler options
+int threads = 0;
+int numa = 0;
+
+// SCVB0 options
+int batch_size = 256;
+int save_interval = 0;
+double corpus_tokens = 0.0;
 
 void Usage() {
   fprintf(stderr,
@@ -48,7 +82,9 @@ void Usage() {
           "      The first column of INPUT_FILE is doc ID.\n"
           "      Default is \"%d\".\n"
           "    -sampler SAMPLER\n"
-          "      SAMPLER can be lda, sparselda, aliaslda, lightlda.\n"
+          "      SAMPLER can be lda, sparselda, aliaslda, lightlda, fpluslda,\n"
+          "      warplda, polyaurnlda, scvb0.\n"
+          "      scvb0 trains online, INPUT_FILE can be \"-\"(stdin).\n"
           "      Default is \"%s\".\n"
           "    -K TOPIC\n"
           "      Number of topics.\n"
@@ -89,18 +125,109 @@ void Usage() {
           "    -log_likelihood_interval INTERVAL\n"
           "      Interval of calculating log likelihood. 0 disables it.\n"
           "      Default is \"%d\".\n"
-          "    -storage_type 1/2/3\n"
-          "      Storage type. 1, dense; 2, array; 3, sparse.\n"
+          "    -storage_type 1/2/3/4/5/6\n"
+          "      Storage type. 1, dense; 2, array; 3, sparse;\n"
+          "      4, sparse with inline storage for short rows;\n"
+          "      5, dense with a list of nonzero counts;\n"
+          "      6, sparse ordered by descending counts.\n"
+          "      Default is \"%d\".\n"
+          "    -huge_pages 0/1\n"
+          "      Back sparse tables(storage type 3) with huge pages.\n"
+          "      Default is \"%d\".\n"
+          "    -compact_interval INTERVAL\n"
+          "      Interval of compacting sparse tables(storage type 3).\n"
+          "      0 disables it.\n"
+          "      Default is \"%d\".\n"
+          "    -compact_topics_interval INTERVAL\n"
+          "      Interval of dropping topics and renumbering the others,\n"
+          "      which continues with a smaller K.\n"
+          "      The mapping is saved as OUTPUT_PREFIX-topic-map.\n"
+          "      0 disables it.\n"
+          "      Default is \"%d\".\n"
+          "    -min_topic_count COUNT\n"
+          "      Drop topics of at most COUNT words(compact_topics_interval),\n"
+          "      moving the words to random topics.\n"
+          "      Default is \"%d\".\n"
+          "    -sort_tokens 0/1\n"
+          "      Sort tokens of each document by word id,\n"
+          "      so that repeated words are sampled in runs.\n"
+          "      Default is \"%d\".\n"
+          "    -compress_words 0/1\n"
+          "      Keep word ids compressed in memory, which sorts tokens.\n"
+          "      Default is \"%d\".\n"
+          "    -memory_limit MB\n"
+          "      Memory limit of training in MB. 0 is unlimited.\n"
+          "      Training over it switches to the smallest storage type,\n"
+          "      then caps memory of word proposals, or refuses to start.\n"
+          "      Default is \"%d\".\n"
+          "    -implicit_doc_len LEN\n"
+          "      Docs of at most LEN(<= %d) tokens keep no doc-topic counts,\n"
+          "      which are counted from their topics when sampled.\n"
+          "      0 disables it.\n"
+          "      Default is \"%d\".\n"
+          "    -large_k 0/1\n"
+          "      Large K mode for 100k or more topics, which splits\n"
+          "      the word tree of fpluslda, and which lda refuses.\n"
+          "      Default is \"%d\".\n"
+          "    -remap_words 0/1\n"
+          "      Renumber words in descending order of counts,\n"
+          "      and prune words by the following options.\n"
+          "      The mapping is saved as OUTPUT_PREFIX-word-map.\n"
+          "      Default is \"%d\".\n"
+          "    -min_word_count COUNT\n"
+          "      Prune words occurring fewer times(remap_words).\n"
+          "      Default is \"%d\".\n"
+          "    -max_doc_freq FREQ\n"
+          "      Prune words in more proportion of documents(remap_words).\n"
+          "      Default is \"%lg\".\n"
+          "    -stop_words FILE\n"
+          "      Prune word ids listed in FILE(remap_words).\n"
+          "    -sweep K:ALPHA[:BETA],...\n"
+          "      Train a model for each configuration, with the other\n"
+          "      options, in one process sharing the loaded corpus.\n"
+          "      ALPHA and BETA default to the above.\n"
+          "      Models are saved as OUTPUT_PREFIX-K*-alpha*-beta*,\n"
+          "      then their log likelihood and time are compared.\n"
+          "    -sweep_threads THREADS\n"
+          "      Number of models trained at once(sweep), each of which\n"
+          "      samples in one thread. 0 uses all cores.\n"
           "      Default is \"%d\".\n"
           "    -mh_step MH_STEP\n"
-          "      Number of MH steps(aliaslda or lightlda).\n"
+          "      Number of MH steps(aliaslda, lightlda or warplda).\n"
           "      Default is \"%d\".\n"
           "    -enable_word_proposal 0/1\n"
           "      Enable word proposal(lightlda).\n"
           "      Default is \"%d\".\n"
           "    -enable_doc_proposal 0/1\n"
           "      Enable doc proposal(lightlda).\n"
-          "      Default is \"%d\".\n",
+          "      Default is \"%d\".\n"
+          "    -builders BUILDERS\n"
+          "      Number of threads building word proposals ahead of sampling\n"
+          "      (aliaslda or lightlda). 0 builds them inline.\n"
+          "      Default is \"%d\".\n"
+          "    -proposal_memory MB\n"
+          "      Memory budget of cached word proposals in MB\n"
+          "      (aliaslda or lightlda). 0 is unlimited.\n"
+          "      Default is \"%d\".\n"
+          "    -threads THREADS\n"
+          "      Number of threads(polyaurnlda). 0 uses all cores.\n"
+          "      Default is \"%d\".\n"
+          "    -numa 0/1\n"
+          "      Pin threads to NUMA nodes, move tokens of their docs there,\n"
+          "      keep a copy of phi on each node, and log bandwidth of\n"
+          "      each node(polyaurnlda).\n"
+          "      Default is \"%d\".\n"
+          "    -batch_size SIZE\n"
+          "      Number of docs in a mini-batch(scvb0).\n"
+          "      Default is \"%d\".\n"
+          "    -save_interval INTERVAL\n"
+          "      Interval of mini-batches to save the model(scvb0).\n"
+          "      0 only saves it at the end of input.\n"
+          "      Default is \"%d\".\n"
+          "    -corpus_tokens TOKENS\n"
+          "      Expected number of words in the stream(scvb0).\n"
+          "      0 uses the number of words seen so far.\n"
+          "      Default is \"%lg\".\n",
           doc_with_id,
           sampler.c_str(),
           K,
@@ -116,12 +243,199 @@ void Usage() {
           burnin_iteration,
           log_likelihood_interval,
           storage_type,
+          huge_pages,
+          compact_interval,
+          compact_topics_interval,
+          min_topic_count,
+          sort_tokens,
+          compress_words,
+          memory_limit,
+          kMaxImplicitDocLen,
+          implicit_doc_len,
+          large_k,
+          remap_words,
+          min_word_count,
+          max_doc_freq,
+          sweep_threads,
           mh_step,
           enable_word_proposal,
-          enable_doc_proposal);
+          enable_doc_proposal,
+          builders,
+          proposal_memory,
+          threads,
+          numa,
+          batch_size,
+          save_interval,
+          corpus_tokens);
   exit(1);
 }
 
+// a sampler with the above options, without a corpus
+SamplerBase* NewSampler() {
+  SamplerBase* p = NULL;
+  if (sampler == "lda") {
+    p = new GibbsSampler();
+  } else if (sampler == "sparselda") {
+    p = new SparseLDASampler();
+  } else if (sampler == "aliaslda") {
+    AliasLDASampler* pp = new AliasLDASampler();
+    pp->mh_step() = mh_step;
+    pp->builders() = builders;
+    pp->proposal_memory() = proposal_memory;
+    p = pp;
+  } else if (sampler == "lightlda") {
+    LightLDASampler* pp = new LightLDASampler();
+    pp->mh_step() = mh_step;
+    pp->enable_word_proposal() = enable_word_proposal;
+    pp->enable_doc_proposal() = enable_doc_proposal;
+    pp->builders() = builders;
+    pp->proposal_memory() = proposal_memory;
+    p = pp;
+  } else if (sampler == "fpluslda") {
+    p = new FPlusLDASampler();
+  } else if (sampler == "warplda") {
+    WarpLDASampler* pp = new WarpLDASampler();
+    pp->mh_step() = mh_step;
+    p = pp;
+  } else if (sampler == "polyaurnlda") {
+    PolyaUrnLDASampler* pp = new PolyaUrnLDASampler();
+    pp->threads() = threads;
+    pp->numa() = numa;
+    p = pp;
+  }
+
+  p->K() = K;
+  p->alpha() = alpha;
+  p->beta() = beta;
+  p->hp_opt() = hp_opt;
+  p->hp_opt_interval() = hp_opt_interval;
+  p->hp_opt_alpha_shape() = hp_opt_alpha_shape;
+  p->hp_opt_alpha_scale() = hp_opt_alpha_scale;
+  p->hp_opt_alpha_iteration() = hp_opt_alpha_iteration;
+  p->hp_opt_beta_iteration() = hp_opt_beta_iteration;
+  p->total_iteration() = total_iteration;
+  p->burnin_iteration() = burnin_iteration;
+  p->log_likelihood_interval() = log_likelihood_interval;
+  p->storage_type() = storage_type;
+  p->huge_pages() = huge_pages;
+  p->compact_interval() = compact_interval;
+  p->compact_topics_interval() = compact_topics_interval;
+  p->min_topic_count() = min_topic_count;
+  p->sort_tokens() = sort_tokens;
+  p->compress_words() = compress_words;
+  p->memory_limit() = memory_limit;
+  p->implicit_doc_len() = implicit_doc_len;
+  p->large_k() = large_k;
+  p->remap_words() = remap_words;
+  p->min_word_count() = min_word_count;
+  p->max_doc_freq() = max_doc_freq;
+  return p;
+}
+
+struct SweepConfig {
+  int K;
+  double alpha;
+  double beta;
+};
+
+// parse "sweep" of "K:ALPHA[:BETA],...",
+// missing ALPHA and BETA are "alpha" and "beta"
+void ParseSweep(std::vector<SweepConfig>* configs) {
+  size_t begin = 0;
+  for (;;) {
+    size_t end = sweep.find(',', begin);
+    if (end == std::string::npos) {
+      end = sweep.size();
+    }
+    const std::string item = sweep.substr(begin, end - begin);
+    SweepConfig config;
+    config.alpha = alpha;
+    config.beta = beta;
+    const size_t colon1 = item.find(':');
+    config.K = xatoi(item.substr(0, colon1).c_str());
+    if (colon1 != std::string::npos) {
+      const size_t colon2 = item.find(':', colon1 + 1);
+      config.alpha = xatod(item.substr(colon1 + 1,
+                                       colon2 - colon1 - 1).c_str());
+      if (colon2 != std::string::npos) {
+        config.beta = xatod(item.substr(colon2 + 1).c_str());
+      }
+    }
+    configs->push_back(config);
+    if (end == sweep.size()) {
+      break;
+    }
+    begin = end + 1;
+  }
+}
+
+// train a model for each of "configs" at once, in a thread each.
+// The others share the corpus of "loader", which trains the first one.
+int Sweep(SamplerBase* loader, const std::vector<SweepConfig>& configs) {
+  const int n = (int)configs.size();
+  const double tokens = (double)loader->tokens();
+  std::vector<SamplerBase*> samplers(n);
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i == 0) {
+      samplers[i] = loader;
+    } else {
+      samplers[i] = NewSampler();
+      samplers[i]->ShareCorpus(*loader);
+    }
+    samplers[i]->K() = configs[i].K;
+    samplers[i]->alpha() = configs[i].alpha;
+    samplers[i]->beta() = configs[i].beta;
+  }
+
+  std::vector<int> rets(n, 0);
+  std::vector<double> llhs(n, 0.0);
+  std::vector<double> seconds(n, 0.0);
+  const int threads = std::min(n, sweep_threads ? sweep_threads
+                                                : GetMaxThreads());
+  Log("Sweeping %d configurations in %d threads.\n", n, threads);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+  for (i = 0; i < n; i++) {
+    SamplerBase* p = samplers[i];
+    // a random stream of its own keeps a model reproducible
+    RandEngine engine(0705 + i);
+    Rand::SetThreadEngine(&engine);
+    const double begin = GetWallTime();
+    rets[i] = p->Train();
+    seconds[i] = GetWallTime() - begin;
+    if (rets[i] == 0) {
+      char suffix[128];
+      snprintf(suffix, sizeof(suffix), "-K%d-alpha%lg-beta%lg",
+               configs[i].K, configs[i].alpha, configs[i].beta);
+      llhs[i] = p->LogLikelihood();
+      p->SaveModel(output_prefix + suffix);
+    }
+    Rand::SetThreadEngine(NULL);
+    // free its tables now, but the shared corpus after all
+    if (p != loader) {
+      delete p;
+    }
+  }
+  delete loader;
+
+  int failed = 0;
+  Log("%8s %10s %10s %12s %10s %12s\n",
+      "K", "alpha", "beta", "LLH/word", "seconds", "tokens/sec");
+  for (i = 0; i < n; i++) {
+    if (rets[i] != 0) {
+      Log("%8d %10lg %10lg %12s\n",
+          configs[i].K, configs[i].alpha, configs[i].beta, "failed");
+      failed++;
+      continue;
+    }
+    Log("%8d %10lg %10lg %12lg %10.1lf %12.0lf\n",
+        configs[i].K, configs[i].alpha, configs[i].beta,
+        llhs[i] / tokens, seconds[i],
+        tokens * total_iteration / seconds[i]);
+  }
+  return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv) {
   if (argc == 1) {
     Usage();
@@ -198,6 +512,66 @@ int main(int argc, char** argv) {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
       storage_type = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-huge_pages") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      huge_pages = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-compact_interval") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      compact_interval = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-compact_topics_interval") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      compact_topics_interval = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-min_topic_count") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      min_topic_count = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-sort_tokens") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      sort_tokens = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-compress_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      compress_words = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-memory_limit") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      memory_limit = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-implicit_doc_len") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      implicit_doc_len = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-large_k") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      large_k = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-remap_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      remap_words = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-min_word_count") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      min_word_count = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-max_doc_freq") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      max_doc_freq = xatod(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stop_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      stop_words_filename = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-sweep") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      sweep = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-sweep_threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      sweep_threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-mh_step") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
       mh_step = xatoi(argv[i + 1]);
@@ -210,6 +584,34 @@ int main(int argc, char** argv) {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
       enable_doc_proposal = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-builders") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      builders = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-proposal_memory") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      proposal_memory = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-numa") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      numa = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-batch_size") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      batch_size = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-save_interval") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      save_interval = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-corpus_tokens") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      corpus_tokens = xatod(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
     } else {
       i++;
     }
@@ -234,7 +636,11 @@ int main(int argc, char** argv) {
   CHECK_EXIT(sampler == "lda"
              || sampler == "sparselda"
              || sampler == "aliaslda"
-             || sampler == "lightlda");
+             || sampler == "lightlda"
+             || sampler == "fpluslda"
+             || sampler == "warplda"
+             || sampler == "polyaurnlda"
+             || sampler == "scvb0");
   CHECK_EXIT(K >= 2);
   CHECK_EXIT(alpha >= 0.0);
   CHECK_EXIT(beta > 0.0);
@@ -248,11 +654,32 @@ int main(int argc, char** argv) {
   CHECK_EXIT(burnin_iteration >= 0);
   CHECK_EXIT(total_iteration > burnin_iteration);
   CHECK_EXIT(log_likelihood_interval >= 0);
-  CHECK_EXIT(storage_type >= 1 && storage_type <= 3);
+  CHECK_EXIT(storage_type >= 1 && storage_type <= 6);
+  CHECK_EXIT(huge_pages >= 0 && huge_pages <= 1);
+  CHECK_EXIT(compact_interval >= 0);
+  CHECK_EXIT(compact_topics_interval >= 0);
+  CHECK_EXIT(min_topic_count >= 0);
+  CHECK_EXIT(sort_tokens >= 0 && sort_tokens <= 1);
+  CHECK_EXIT(compress_words >= 0 && compress_words <= 1);
+  CHECK_EXIT(memory_limit >= 0);
+  CHECK_EXIT(implicit_doc_len >= 0 && implicit_doc_len <= kMaxImplicitDocLen);
+  CHECK_EXIT(large_k >= 0 && large_k <= 1);
+  CHECK_EXIT(remap_words >= 0 && remap_words <= 1);
+  CHECK_EXIT(min_word_count >= 0);
+  CHECK_EXIT(max_doc_freq > 0.0 && max_doc_freq <= 1.0);
+  CHECK_EXIT(sweep_threads >= 0);
+  CHECK_EXIT(sweep.empty() || sampler != "scvb0");
   CHECK_EXIT(mh_step > 0);
   CHECK_EXIT(enable_word_proposal >= 0 && enable_word_proposal <= 1);
   CHECK_EXIT(enable_doc_proposal >= 0 && enable_doc_proposal <= 1);
   CHECK_EXIT(enable_word_proposal + enable_doc_proposal != 0);
+  CHECK_EXIT(builders >= 0);
+  CHECK_EXIT(proposal_memory >= 0);
+  CHECK_EXIT(threads >= 0);
+  CHECK_EXIT(numa >= 0 && numa <= 1);
+  CHECK_EXIT(batch_size > 0);
+  CHECK_EXIT(save_interval >= 0);
+  CHECK_EXIT(corpus_tokens >= 0.0);
 
   input_corpus_filename = argv[1];
   if (argc >= 3) {
@@ -261,42 +688,53 @@ int main(int argc, char** argv) {
     output_prefix = input_corpus_filename;
   }
 
-  SamplerBase* p = NULL;
-  if (sampler == "lda") {
-    p = new GibbsSampler();
-  } else if (sampler == "sparselda") {
-    p = new SparseLDASampler();
-  } else if (sampler == "aliaslda") {
-    AliasLDASampler* pp = new AliasLDASampler();
-    pp->mh_step() = mh_step;
-    p = pp;
-  } else if (sampler == "lightlda") {
-    LightLDASampler* pp = new LightLDASampler();
-    pp->mh_step() = mh_step;
-    pp->enable_word_proposal() = enable_word_proposal;
-    pp->enable_doc_proposal() = enable_doc_proposal;
-    p = pp;
+  if (sampler == "scvb0") {
+    SCVB0 online;
+    online.K() = K;
+    online.alpha() = alpha;
+    online.beta() = beta;
+    online.batch_size() = batch_size;
+    online.save_interval() = save_interval;
+    online.corpus_tokens() = corpus_tokens;
+    ScopedFile fp(input_corpus_filename.c_str(), ScopedFile::Read);
+    online.Train(fp, doc_with_id, output_prefix);
+    return 0;
   }
 
-  p->K() = K;
-  p->alpha() = alpha;
-  p->beta() = beta;
-  p->hp_opt() = hp_opt;
-  p->hp_opt_interval() = hp_opt_interval;
-  p->hp_opt_alpha_shape() = hp_opt_alpha_shape;
-  p->hp_opt_alpha_scale() = hp_opt_alpha_scale;
-  p->hp_opt_alpha_iteration() = hp_opt_alpha_iteration;
-  p->hp_opt_beta_iteration() = hp_opt_beta_iteration;
-  p->total_iteration() = total_iteration;
-  p->burnin_iteration() = burnin_iteration;
-  p->log_likelihood_interval() = log_likelihood_interval;
-  p->storage_type() = storage_type;
+  std::vector<SweepConfig> configs;
+  if (!sweep.empty()) {
+    ParseSweep(&configs);
+    for (size_t i = 0; i < configs.size(); i++) {
+      CHECK_EXIT(configs[i].K >= 2);
+      CHECK_EXIT(configs[i].alpha >= 0.0);
+      CHECK_EXIT(configs[i].beta > 0.0);
+    }
+  }
+
+  SamplerBase* p = NewSampler();
+  if (!stop_words_filename.empty()) {
+    // word ids separated by blanks or lines
+    ScopedFile fp(stop_words_filename.c_str(), ScopedFile::Read);
+    LineReader line_reader;
+    while (line_reader.ReadLine(fp) != NULL) {
+      char* word = strtok(line_reader.buf, " \t\r\n");
+      for (; word; word = strtok(NULL, " \t\r\n")) {
+        p->stop_words().push_back(xatoi(word));
+      }
+    }
+  }
 
   {
     ScopedFile fp(input_corpus_filename.c_str(), ScopedFile::Read);
     p->LoadCorpus(fp, doc_with_id);
   }
-  p->Train();
+  if (!configs.empty()) {
+    return Sweep(p, configs);
+  }
+  if (p->Train() != 0) {
+    delete p;
+    return 1;
+  }
   p->SaveModel(output_prefix);
   delete p;
   return 0;
@@ -2,16 +2,27 @@
 // Author: Yafei Zhang (zhangyafeikimi@gmail.com)
 //
 
+#include "common/parallel.h"
 #include "lda/rand.h"
 #include "lda/sampler.h"
 
+double LightLDASampler::SamplerBytes(double word_nnz) const {
+  return word_proposal_.EstimateBytes(V_, K_, word_nnz) + K_ * sizeof(double);
+}
+
+int LightLDASampler::LimitSamplerBytes(double bytes, double word_nnz) {
+  return word_proposal_.LimitBytes(V_, K_, word_nnz,
+                                   bytes - K_ * sizeof(double));
+}
+
 int LightLDASampler::InitializeSampler() {
   hp_alpha_alias_table_.Build(hp_alpha_, hp_sum_alpha_);
-  word_topics_pdf_.resize(K_);
-  words_topic_samples_.resize(V_);
   if (mh_step_ == 0) {
     mh_step_ = 8;
   }
+  word_proposal_.Init(&words_topics_count_, &topics_count_, NULL,
+                      &hp_beta_, &hp_sum_beta_,
+                      corpus_, V_, K_, K_ * mh_step_);
   return 0;
 }
 
@@ -25,21 +36,49 @@ void LightLDASampler::PostSampleCorpus() {
   }
 }
 
+void LightLDASampler::SampleCorpus() {
+  const int builders = word_proposal_.builders();
+  word_proposal_.BeginIteration();
+  if (builders == 0) {
+    SamplerBase::SampleCorpus();
+    word_proposal_.EndIteration();
+  } else {
+    // thread 0 samples, the others build word proposals ahead of it
+#pragma omp parallel num_threads(builders + 1)
+    {
+      const int id = GetThreadId();
+      if (id == 0) {
+        SamplerBase::SampleCorpus();
+        word_proposal_.EndIteration();
+      } else {
+        word_proposal_.RunBuilder(id - 1);
+      }
+    }
+  }
+}
+
+void LightLDASampler::PreSampleDocument(int m) {
+  SamplerBase::PreSampleDocument(m);
+  word_proposal_.Advance(m);
+}
+
 void LightLDASampler::SampleDocument(int m) {
-  const Doc& doc = docs_[m];
-  Word* word = &words_[doc.index];
-  IntTable& doc_m_topics_count = docs_topics_count_[m];
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &doc_words_);
+  Topic* topic = &topics_[doc.index];
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
   int s, t;
-  int N_ms, N_vs, N_s, N_mt, N_vt, N_t;
-  int N_ms_prime, N_vs_prime, N_s_prime;
-  int N_mt_prime, N_vt_prime, N_t_prime;
+  int N_ms, N_vs, N_mt, N_vt;
+  int N_ms_prime, N_vs_prime, N_mt_prime, N_vt_prime;
+  TokenIndex N_s, N_t, N_s_prime, N_t_prime;
   double hp_alpha_s, hp_alpha_t;
   double accept_rate;
 
-  for (int n = 0; n < doc.N; n++, word++) {
-    const int v = word->v;
+  for (int n = 0; n < doc.N; n++, word++, topic++) {
+    const int v = *word;
     IntTable& word_v_topics_count = words_topics_count_[v];
-    const int old_k = word->k;
+    const int old_k = *topic;
     s = old_k;
 
     N_ms_prime = N_ms = doc_m_topics_count[s];
@@ -88,7 +127,7 @@ void LightLDASampler::SampleDocument(int m) {
             * (N_t + hp_sum_beta_) / (N_s + hp_sum_beta_);
 
           if (/*accept_rate >= 1.0 || */Rand::Double01() < accept_rate) {
-            word->k = t;
+            *topic = (Topic)t;
             s = t;
             N_ms = N_mt;
             N_vs = N_vt;
@@ -133,7 +172,7 @@ void LightLDASampler::SampleDocument(int m) {
             * (N_ms + hp_alpha_s) / (N_mt + hp_alpha_t);
 
           if (/*accept_rate >= 1.0 || */Rand::Double01() < accept_rate) {
-            word->k = t;
+            *topic = (Topic)t;
             s = t;
             N_ms = N_mt;
             N_vs = N_vt;
@@ -158,52 +197,6 @@ void LightLDASampler::SampleDocument(int m) {
   }
 }
 
-int LightLDASampler::SampleWithWord(int v) {
-  // word-proposal: (N_vk + beta)/(N_k + sum_beta)
-  std::vector<int>& word_v_topic_samples = words_topic_samples_[v];
-  if (word_v_topic_samples.empty()) {
-    double sum = 0.0;
-    const IntTable& word_v_topics_count = words_topics_count_[v];
-    if (storage_type_ == kSparseHist) {
-      word_topics_pdf_.assign(K_, 0.0);
-      IntTable::const_iterator first = word_v_topics_count.begin();
-      IntTable::const_iterator last = word_v_topics_count.end();
-      for (; first != last; ++first) {
-        const int k = first.id();
-        double& pdf = word_topics_pdf_[k];
-        pdf = (first.count() + hp_beta_) / (topics_count_[k] + hp_sum_beta_);
-        sum += pdf;
-      }
-
-      for (int k = 0; k < K_; k++) {
-        double& pdf = word_topics_pdf_[k];
-        if (pdf == 0.0) {
-          pdf = hp_beta_ / (topics_count_[k] + hp_sum_beta_);
-          sum += pdf;
-        }
-      }
-    } else {
-      for (int k = 0; k < K_; k++) {
-        double& pdf = word_topics_pdf_[k];
-        pdf = (word_v_topics_count[k] + hp_beta_)
-              / (topics_count_[k] + hp_sum_beta_);
-        sum += pdf;
-      }
-    }
-
-    word_alias_table_.Build(word_topics_pdf_, sum);
-    int cached_samples = K_ * mh_step_;
-    word_v_topic_samples.reserve(cached_samples);
-    for (int i = 0; i < cached_samples; i++) {
-      word_v_topic_samples.push_back(word_alias_table_.Sample());
-    }
-  }
-
-  const int new_k = word_v_topic_samples.back();
-  word_v_topic_samples.pop_back();
-  return new_k;
-}
-
 int LightLDASampler::SampleWithDoc(const Doc& doc, int v) {
   // doc-proposal: N_mk + alpha_k
   double sample = Rand::Double01() * (hp_sum_alpha_ + doc.N);
@@ -211,13 +204,13 @@ int LightLDASampler::SampleWithDoc(const Doc& doc, int v) {
     return hp_alpha_alias_table_.Sample(sample / hp_sum_alpha_);
   } else {
     int offset = (int)(sample - hp_sum_alpha_);
-    int index;
+    TokenIndex index;
     if (offset != doc.N) {
       index = doc.index + offset;
     } else {
       // rare numerical errors may lie in this branch
       index = doc.index + offset - 1;
     }
-    return words_[index].k;
+    return topics_[index];
   }
 }
@@ -0,0 +1,131 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#if defined __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "lda/numa.h"
+
+namespace {
+
+#if defined __linux__
+// from linux/mempolicy.h
+const int kMpolBind = 2;
+const unsigned kMpolMfMove = 1 << 1;
+
+// read a list like "0-3,8,10-11" from "filename",
+// return 0 on success
+int ReadRangeList(const char* filename, std::vector<int>* ids) {
+  FILE* fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  char buf[4096];
+  const char* line = fgets(buf, sizeof(buf), fp);
+  fclose(fp);
+  if (line == NULL) {
+    return -1;
+  }
+
+  ids->clear();
+  char* p = buf;
+  while (*p >= '0' && *p <= '9') {
+    const int first = (int)strtol(p, &p, 10);
+    int last = first;
+    if (*p == '-') {
+      last = (int)strtol(p + 1, &p, 10);
+    }
+    for (int id = first; id <= last; id++) {
+      ids->push_back(id);
+    }
+    if (*p == ',') {
+      p++;
+    }
+  }
+  return ids->empty() ? -1 : 0;
+}
+#endif
+
+}  // namespace
+
+void Numa::Load() {
+  node_ids_.clear();
+  cpus_.clear();
+#if defined __linux__
+  std::vector<int> node_ids;
+  if (ReadRangeList("/sys/devices/system/node/online", &node_ids) == 0) {
+    for (size_t i = 0; i < node_ids.size(); i++) {
+      char filename[128];
+      std::vector<int> cpus;
+      snprintf(filename, sizeof(filename),
+               "/sys/devices/system/node/node%d/cpulist", node_ids[i]);
+      // nodes of memory only have no cpus
+      if (ReadRangeList(filename, &cpus) == 0) {
+        node_ids_.push_back(node_ids[i]);
+        cpus_.push_back(cpus);
+      }
+    }
+  }
+#endif
+  if (node_ids_.empty()) {
+    node_ids_.push_back(-1);
+    cpus_.resize(1);
+  }
+}
+
+int Numa::ThreadNode(int i, int threads) const {
+  // fewer threads than nodes take the first nodes, one each
+  const int used = std::min(nodes(), threads);
+  return (int)((long long)i * used / threads);  // NOLINT
+}
+
+int Numa::PinThread(int node) const {
+#if defined __linux__
+  const std::vector<int>& cpus = cpus_[node];
+  if (node_ids_[node] < 0) {
+    return -1;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); i++) {
+    CPU_SET(cpus[i], &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+#else
+  (void)node;
+  return -1;
+#endif
+}
+
+int Numa::Place(const void* p, size_t bytes, int node) const {
+#if defined __linux__ && defined SYS_mbind
+  const int id = node_ids_[node];
+  if (id < 0 || bytes == 0) {
+    return -1;
+  }
+  // whole pages within the range, the partial ones at both ends stay
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t begin = ((size_t)p + page - 1) / page * page;
+  const size_t end = ((size_t)p + bytes) / page * page;
+  if (begin >= end) {
+    return 0;
+  }
+  const int bits = 8 * (int)sizeof(unsigned long);  // NOLINT
+  std::vector<unsigned long> mask(id / bits + 1, 0);  // NOLINT
+  mask[id / bits] = 1UL << (id % bits);
+  return syscall(SYS_mbind, begin, end - begin, kMpolBind,
+                 &mask[0], mask.size() * bits + 1, kMpolMfMove) == 0
+         ? 0 : -1;
+#else
+  (void)p;
+  (void)bytes;
+  (void)node;
+  return -1;
+#endif
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// NUMA nodes, thread pinning and page placement
+//
+
+#ifndef SRC_LDA_NUMA_H_
+#define SRC_LDA_NUMA_H_
+
+#include <stddef.h>
+#include <vector>
+
+// NUMA nodes and their cpus, read from /sys/devices/system/node on linux,
+// without libnuma.
+// Elsewhere, or if it is unreadable, all cpus are one node,
+// where pinning and placement do nothing.
+class Numa {
+ private:
+  std::vector<int> node_ids_;  // system ids of nodes
+  // cpus_[i]: cpu ids of node i
+  std::vector<std::vector<int> > cpus_;
+
+ public:
+  int nodes() const {
+    return (int)node_ids_.size();
+  }
+
+  // system id of node i, -1 if nodes are unknown
+  int node_id(int i) const {
+    return node_ids_[i];
+  }
+
+  void Load();
+  // node of thread i of "threads",
+  // threads are split into blocks of nodes in order,
+  // so only the first min(nodes(), threads) nodes are used
+  int ThreadNode(int i, int threads) const;
+  // pin the calling thread to cpus of node "node",
+  // return 0 on success
+  int PinThread(int node) const;
+  // move pages of [p, p + bytes) to node "node",
+  // return 0 on success
+  int Place(const void* p, size_t bytes, int node) const;
+};
+
+#endif  // SRC_LDA_NUMA_H_
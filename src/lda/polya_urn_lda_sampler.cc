@@ -0,0 +1,448 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// Partially collapsed LDA with a sparse Polya urn approximation of phi.
+// Given phi, documents are independent,
+// so they are sampled in parallel,
+// and word-topic counts are updated at the end of the iteration.
+//
+
+#include <algorithm>
+#include "common/parallel.h"
+#include "common/x.h"
+#include "lda/rand.h"
+#include "lda/sampler.h"
+
+double PolyaUrnLDASampler::SamplerBytes(double word_nnz) const {
+  // phi in CSR over nonzero counts and about beta * V * K priors,
+  // then topic changes of tokens, most of which change early
+  // with a copy of phi on each NUMA node(numa)
+  const double priors = hp_beta_ * V_ * K_;
+  const int threads = threads_ ? threads_ : GetMaxThreads();
+  int copies = 1;
+  if (numa_) {
+    Numa topology;
+    topology.Load();
+    copies = std::min(topology.nodes(), threads);
+  }
+  return (word_nnz + priors)
+         * (sizeof(int) + sizeof(double) + sizeof(AliasItem)) * copies
+         + priors * (sizeof(std::pair<int, int>) + sizeof(int))
+         + V_ * (sizeof(int) + 2 * sizeof(double)) * copies
+         + (double)topics_.size() * sizeof(TopicChange)
+         + (double)threads * K_ * 4 * sizeof(double);
+}
+
+int PolyaUrnLDASampler::DocRowThreads() const {
+  // docs are sampled in parallel, each updating its own row
+  return threads_ ? threads_ : GetMaxThreads();
+}
+
+int PolyaUrnLDASampler::InitializeSampler() {
+  SetMaxThreads(threads_);
+  // it runs again after topics are compacted,
+  // when existing states keep their random streams
+  const int seeded = (int)thread_states_.size();
+  thread_states_.resize(GetMaxThreads());
+  for (int i = 0; i < (int)thread_states_.size(); i++) {
+    ThreadState& state = thread_states_[i];
+    if (i >= seeded) {
+      state.rand.Seed(0705 + i);
+    }
+    state.doc_topics.reserve(K_);
+    state.doc_cdf.reserve(K_);
+    state.node = 0;
+  }
+  phis_.resize(1);
+  phis_[0].alpha_sums.resize(V_);
+  Log("Sampling with %d threads.\n", (int)thread_states_.size());
+  if (numa_) {
+    InitializeNuma();
+  }
+  return 0;
+}
+
+void PolyaUrnLDASampler::InitializeNuma() {
+  const int threads = (int)thread_states_.size();
+  int t;
+  topology_.Load();
+  for (t = 0; t < threads; t++) {
+    thread_states_[t].node = topology_.ThreadNode(t, threads);
+  }
+  // nodes of threads are 0...the last one, a copy of phi for each
+  phis_.resize(thread_states_[threads - 1].node + 1);
+
+  // thread t runs iteration t of a static schedule of chunk 1
+  int pinned = 0;
+#pragma omp parallel for schedule(static, 1) num_threads(threads) \
+  reduction(+ : pinned)
+  for (t = 0; t < threads; t++) {
+    if (topology_.PinThread(thread_states_[t].node) == 0) {
+      pinned++;
+    }
+  }
+
+  // contiguous docs of about the same # of tokens
+  const std::vector<Doc>& docs = corpus_->docs;
+  const double tokens = (double)topics_.size();
+  thread_docs_.assign(threads + 1, M_);
+  thread_docs_[0] = 0;
+  t = 1;
+  for (int m = 0; m < M_ && t < threads; m++) {
+    if (docs[m].index >= tokens * t / threads) {
+      thread_docs_[t++] = m;
+    }
+  }
+
+  // migrate pages of tokens of each thread to its node
+  int placed = 0;
+  for (t = 0; t < threads; t++) {
+    const int begin = thread_docs_[t];
+    const int end = thread_docs_[t + 1];
+    if (begin == end) {
+      continue;
+    }
+    const TokenIndex first = docs[begin].index;
+    const TokenIndex last = docs[end - 1].index + docs[end - 1].N;
+    const int node = thread_states_[t].node;
+    if (topology_.Place(&topics_[first],
+                        (last - first) * sizeof(Topic), node) == 0) {
+      placed++;
+    }
+    if (!corpus_->words.empty()) {
+      topology_.Place(&corpus_->words[first],
+                      (last - first) * sizeof(int), node);
+    }
+  }
+  Log("NUMA: %d nodes, %d of %d threads pinned, tokens of %d moved.\n",
+      topology_.nodes(), pinned, threads, placed);
+}
+
+void PolyaUrnLDASampler::SampleCorpus() {
+  SamplePhi();
+
+  // PreSampleDocument and PostSampleDocument are not thread safe
+  int m;
+  if (numa_) {
+    ReplicatePhi();
+    const int threads = (int)thread_states_.size();
+    int t;
+#pragma omp parallel for schedule(static, 1) num_threads(threads) private(m)
+    for (t = 0; t < threads; t++) {
+      ThreadState* state = &thread_states_[t];
+      const double begin = GetWallTime();
+      state->tokens = 0;
+      for (m = thread_docs_[t]; m < thread_docs_[t + 1]; m++) {
+        SampleDocument(m, state);
+        state->tokens += corpus_->docs[m].N;
+      }
+      state->seconds = GetWallTime() - begin;
+    }
+    LogNodes();
+  } else {
+#pragma omp parallel for schedule(dynamic, 64)
+    for (m = 0; m < M_; m++) {
+      SampleDocument(m, &thread_states_[GetThreadId()]);
+    }
+  }
+  ApplyChanges();
+
+  for (m = 0; m < M_; m++) {
+    PostSampleDocument(m);
+  }
+}
+
+void PolyaUrnLDASampler::SampleDocument(int m) {
+  SampleDocument(m, &thread_states_[0]);
+  ApplyChanges();
+}
+
+void PolyaUrnLDASampler::ReplicatePhi() {
+  const int threads = (int)thread_states_.size();
+  int t;
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+  for (t = 0; t < threads; t++) {
+    const int node = thread_states_[t].node;
+    // the first thread of each other node
+    if (node != 0 && (t == 0 || thread_states_[t - 1].node != node)) {
+      phis_[node] = phis_[0];
+    }
+  }
+}
+
+void PolyaUrnLDASampler::LogNodes() const {
+  std::vector<double> tokens(phis_.size(), 0.0);
+  std::vector<double> seconds(phis_.size(), 0.0);
+  std::vector<int> threads(phis_.size(), 0);
+  for (size_t t = 0; t < thread_states_.size(); t++) {
+    const ThreadState& state = thread_states_[t];
+    tokens[state.node] += state.tokens;
+    seconds[state.node] = std::max(seconds[state.node], state.seconds);
+    threads[state.node]++;
+  }
+  for (size_t i = 0; i < phis_.size(); i++) {
+    const double rate = seconds[i] > 0.0 ? tokens[i] / seconds[i] : 0.0;
+    // a word and a topic of each token are read, and the topic written
+    Log("Node %d: %d threads, %.0lf tokens/sec, "
+        "%.1lfMB/s of words and topics.\n",
+        (int)i, threads[i], rate,
+        rate * (sizeof(int) + 2 * sizeof(Topic)) / 1048576.0);
+  }
+}
+
+void PolyaUrnLDASampler::SamplePhi() {
+  const IntTables& words_topics_count = words_topics_count_;
+  PhiTable& table = phis_[0];
+  const int threads = (int)thread_states_.size();
+  int v, k, i;
+
+  // phi_kv ~ Poisson(N_vk + beta), then normalized over v.
+  // When N_vk == 0, Poisson(beta) is almost always 0.
+  // So for each topic k, draw the total of them at once,
+  // and scatter it to random words with N_vk == 0.
+  std::vector<int> words_nnz(V_, 0);
+  std::vector<int> topics_nnz(K_, 0);
+  for (v = 0; v < V_; v++) {
+    const IntTable& word_v_topics_count = words_topics_count[v];
+    IntTable::const_iterator first = word_v_topics_count.begin();
+    IntTable::const_iterator last = word_v_topics_count.end();
+    for (; first != last; ++first) {
+      if (first.count()) {
+        ++words_nnz[v];
+        ++topics_nnz[first.id()];
+      }
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for (k = 0; k < K_; k++) {
+    ThreadState& state = thread_states_[GetThreadId()];
+    const int zeros = V_ - topics_nnz[k];
+    if (zeros == 0) {
+      continue;
+    }
+    int n = state.rand.Poisson(hp_beta_ * zeros);
+    while (n > 0) {
+      const int random_v = (int)state.rand.UInt(V_);
+      if (words_topics_count[random_v][k] == 0) {
+        state.prior_words.push_back(std::make_pair(random_v, k));
+        n--;
+      }
+    }
+  }
+
+  // group prior words by word
+  std::vector<int> prior_offsets(V_ + 1, 0);
+  for (i = 0; i < threads; i++) {
+    const std::vector<std::pair<int, int> >& prior_words =
+      thread_states_[i].prior_words;
+    for (int j = 0; j < (int)prior_words.size(); j++) {
+      ++prior_offsets[prior_words[j].first + 1];
+    }
+  }
+  for (v = 0; v < V_; v++) {
+    prior_offsets[v + 1] += prior_offsets[v];
+  }
+  std::vector<int> prior_topics(prior_offsets[V_]);
+  {
+    std::vector<int> next(prior_offsets.begin(), prior_offsets.end() - 1);
+    for (i = 0; i < threads; i++) {
+      std::vector<std::pair<int, int> >& prior_words =
+        thread_states_[i].prior_words;
+      for (int j = 0; j < (int)prior_words.size(); j++) {
+        prior_topics[next[prior_words[j].first]++] = prior_words[j].second;
+      }
+      prior_words.clear();
+    }
+  }
+
+  // draw phi into rows with enough room
+  std::vector<int> raw_offsets(V_ + 1, 0);
+  for (v = 0; v < V_; v++) {
+    raw_offsets[v + 1] = raw_offsets[v] + words_nnz[v]
+                         + prior_offsets[v + 1] - prior_offsets[v];
+  }
+  std::vector<int> sizes(V_, 0);
+  table.topics.resize(raw_offsets[V_]);
+  table.values.resize(raw_offsets[V_]);
+  for (i = 0; i < threads; i++) {
+    thread_states_[i].topics_sum.assign(K_, 0.0);
+  }
+
+#pragma omp parallel for schedule(dynamic, 64)
+  for (v = 0; v < V_; v++) {
+    ThreadState& state = thread_states_[GetThreadId()];
+    std::vector<std::pair<int, double> >& items = state.items;
+    items.clear();
+
+    const IntTable& word_v_topics_count = words_topics_count[v];
+    IntTable::const_iterator first = word_v_topics_count.begin();
+    IntTable::const_iterator last = word_v_topics_count.end();
+    for (; first != last; ++first) {
+      if (first.count()) {
+        const int x = state.rand.Poisson(first.count() + hp_beta_);
+        if (x) {
+          items.push_back(std::make_pair(first.id(), (double)x));
+        }
+      }
+    }
+    for (int j = prior_offsets[v]; j < prior_offsets[v + 1]; j++) {
+      items.push_back(std::make_pair(prior_topics[j], 1.0));
+    }
+    std::sort(items.begin(), items.end());
+
+    int* topic = &table.topics[raw_offsets[v]];
+    double* phi = &table.values[raw_offsets[v]];
+    int size = 0;
+    for (int j = 0; j < (int)items.size(); j++) {
+      if (size && topic[size - 1] == items[j].first) {
+        phi[size - 1] += items[j].second;
+      } else {
+        topic[size] = items[j].first;
+        phi[size] = items[j].second;
+        size++;
+      }
+      state.topics_sum[items[j].first] += items[j].second;
+    }
+    sizes[v] = size;
+  }
+
+  // squeeze rows together
+  table.offsets.resize(V_ + 1);
+  table.offsets[0] = 0;
+  for (v = 0; v < V_; v++) {
+    const int from = raw_offsets[v];
+    const int to = table.offsets[v];
+    for (int j = 0; j < sizes[v]; j++) {
+      table.topics[to + j] = table.topics[from + j];
+      table.values[to + j] = table.values[from + j];
+    }
+    table.offsets[v + 1] = to + sizes[v];
+  }
+  table.topics.resize(table.offsets[V_]);
+  table.values.resize(table.offsets[V_]);
+  table.alias.resize(table.offsets[V_]);
+
+  std::vector<double>& topics_sum = thread_states_[0].topics_sum;
+  for (i = 1; i < threads; i++) {
+    const std::vector<double>& thread_topics_sum =
+      thread_states_[i].topics_sum;
+    for (k = 0; k < K_; k++) {
+      topics_sum[k] += thread_topics_sum[k];
+    }
+  }
+
+  // normalize phi and build alias tables over alpha_k * phi_kv
+#pragma omp parallel for schedule(dynamic, 64)
+  for (v = 0; v < V_; v++) {
+    ThreadState& state = thread_states_[GetThreadId()];
+    const int begin = table.offsets[v];
+    const int size = table.offsets[v + 1] - begin;
+    std::vector<double>& alpha_phi = state.doc_cdf;
+    double sum = 0.0;
+    alpha_phi.resize(size);
+    for (int j = 0; j < size; j++) {
+      const int k = table.topics[begin + j];
+      double& phi = table.values[begin + j];
+      phi /= topics_sum[k];
+      alpha_phi[j] = hp_alpha_[k] * phi;
+      sum += alpha_phi[j];
+    }
+    table.alpha_sums[v] = sum;
+    if (size) {
+      state.alias.Build(&alpha_phi[0], size, sum, &table.alias[begin]);
+    }
+  }
+}
+
+void PolyaUrnLDASampler::SampleDocument(int m, ThreadState* state) {
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &state->doc_words);
+  Topic* topic = &topics_[doc.index];
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+  std::vector<int>& doc_topics = state->doc_topics;
+  std::vector<double>& doc_cdf = state->doc_cdf;
+  const PhiTable& table = phis_[state->node];
+
+  for (int n = 0; n < doc.N; n++, word++, topic++) {
+    const int v = *word;
+    const int old_k = *topic;
+    --doc_m_topics_count[old_k];
+
+    // p(k) = alpha_k * phi_kv  [alias tables]
+    //      + N_mk * phi_kv  [doc bucket]
+    double doc_sum = 0.0;
+    doc_topics.clear();
+    doc_cdf.clear();
+    IntTable::const_iterator first = doc_m_topics_count.begin();
+    IntTable::const_iterator last = doc_m_topics_count.end();
+    for (; first != last; ++first) {
+      const int k = first.id();
+      const double pdf = first.count() * Phi(table, v, k);
+      if (pdf > 0.0) {
+        doc_sum += pdf;
+        doc_topics.push_back(k);
+        doc_cdf.push_back(doc_sum);
+      }
+    }
+
+    const double alpha_sum = table.alpha_sums[v];
+    const double sample = state->rand.Double01() * (doc_sum + alpha_sum);
+    int new_k;
+    if (sample < doc_sum) {
+      const int i = (int)(std::upper_bound(doc_cdf.begin(), doc_cdf.end(),
+                                           sample) - doc_cdf.begin());
+      new_k = doc_topics[i];
+    } else if (alpha_sum > 0.0) {
+      const int begin = table.offsets[v];
+      const int size = table.offsets[v + 1] - begin;
+      double u = (sample - doc_sum) / alpha_sum;
+      if (u >= 1.0) {
+        // rare numerical errors may lie in this branch
+        u = 0.0;
+      }
+      new_k = table.topics[begin
+                           + Alias::Sample(&table.alias[begin], size, u)];
+    } else {
+      // word v has no mass under phi, keep its topic
+      new_k = old_k;
+    }
+
+    ++doc_m_topics_count[new_k];
+    if (new_k != old_k) {
+      *topic = (Topic)new_k;
+      TopicChange change;
+      change.v = v;
+      change.old_k = old_k;
+      change.new_k = new_k;
+      state->changes.push_back(change);
+    }
+  }
+}
+
+void PolyaUrnLDASampler::ApplyChanges() {
+  for (int i = 0; i < (int)thread_states_.size(); i++) {
+    std::vector<TopicChange>& changes = thread_states_[i].changes;
+    for (int j = 0; j < (int)changes.size(); j++) {
+      const int old_k = changes[j].old_k;
+      const int new_k = changes[j].new_k;
+      IntTable& word_v_topics_count = words_topics_count_[changes[j].v];
+      --topics_count_[old_k];
+      --word_v_topics_count[old_k];
+      ++topics_count_[new_k];
+      ++word_v_topics_count[new_k];
+    }
+    changes.clear();
+  }
+}
+
+double PolyaUrnLDASampler::Phi(const PhiTable& table, int v, int k) {
+  const int* first = &table.topics[0] + table.offsets[v];
+  const int* last = &table.topics[0] + table.offsets[v + 1];
+  const int* it = std::lower_bound(first, last, k);
+  if (it != last && *it == k) {
+    return table.values[it - &table.topics[0]];
+  }
+  return 0.0;
+}
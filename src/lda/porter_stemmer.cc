@@ -0,0 +1,387 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <string.h>
+#include "lda/porter_stemmer.h"
+
+int PorterStemmer::Stem(char* word, int length) {
+  b_ = word;
+  k_ = length - 1;
+  if (k_ <= 1) {
+    // --DEPARTURE--
+    // words of length 1 or 2 are not stemmed
+    return length;
+  }
+
+  Step1ab();
+  Step1c();
+  Step2();
+  Step3();
+  Step4();
+  Step5();
+  return k_ + 1;
+}
+
+// b_[i] is a consonant
+int PorterStemmer::Cons(int i) const {
+  switch (b_[i]) {
+    case 'a':
+    case 'e':
+    case 'i':
+    case 'o':
+    case 'u':
+      return 0;
+    case 'y':
+      return i == 0 ? 1 : !Cons(i - 1);
+    default:
+      return 1;
+  }
+}
+
+// # of consonant sequences between 0 and j_,
+// <c><v> gives 0, <c>vc<v> gives 1, <c>vcvc<v> gives 2, ...
+int PorterStemmer::M() const {
+  int n = 0;
+  int i = 0;
+  for (;;) {
+    if (i > j_) {
+      return n;
+    }
+    if (!Cons(i)) {
+      break;
+    }
+    i++;
+  }
+  i++;
+  for (;;) {
+    for (;;) {
+      if (i > j_) {
+        return n;
+      }
+      if (Cons(i)) {
+        break;
+      }
+      i++;
+    }
+    i++;
+    n++;
+    for (;;) {
+      if (i > j_) {
+        return n;
+      }
+      if (!Cons(i)) {
+        break;
+      }
+      i++;
+    }
+    i++;
+  }
+}
+
+// 0...j_ contains a vowel
+int PorterStemmer::VowelInStem() const {
+  for (int i = 0; i <= j_; i++) {
+    if (!Cons(i)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// j and j - 1 contain a double consonant
+int PorterStemmer::DoubleC(int j) const {
+  if (j < 1) {
+    return 0;
+  }
+  if (b_[j] != b_[j - 1]) {
+    return 0;
+  }
+  return Cons(j);
+}
+
+// i - 2, i - 1, i has the form consonant-vowel-consonant,
+// and the second consonant is not w, x or y
+int PorterStemmer::CVC(int i) const {
+  if (i < 2 || !Cons(i) || Cons(i - 1) || !Cons(i - 2)) {
+    return 0;
+  }
+  const char ch = b_[i];
+  if (ch == 'w' || ch == 'x' || ch == 'y') {
+    return 0;
+  }
+  return 1;
+}
+
+// 0...k_ ends with "s"
+int PorterStemmer::Ends(const char* s) {
+  const int length = (int)strlen(s);
+  if (s[length - 1] != b_[k_]) {
+    return 0;
+  }
+  if (length > k_ + 1) {
+    return 0;
+  }
+  if (memcmp(b_ + k_ - length + 1, s, length) != 0) {
+    return 0;
+  }
+  j_ = k_ - length;
+  return 1;
+}
+
+// set j_ + 1...k_ to "s", readjusting k_
+void PorterStemmer::SetTo(const char* s) {
+  const int length = (int)strlen(s);
+  memcpy(b_ + j_ + 1, s, length);
+  k_ = j_ + length;
+}
+
+void PorterStemmer::R(const char* s) {
+  if (M() > 0) {
+    SetTo(s);
+  }
+}
+
+// plurals and -ed or -ing
+void PorterStemmer::Step1ab() {
+  if (b_[k_] == 's') {
+    if (Ends("sses")) {
+      k_ -= 2;
+    } else if (Ends("ies")) {
+      SetTo("i");
+    } else if (b_[k_ - 1] != 's') {
+      k_--;
+    }
+  }
+  if (Ends("eed")) {
+    if (M() > 0) {
+      k_--;
+    }
+  } else if ((Ends("ed") || Ends("ing")) && VowelInStem()) {
+    k_ = j_;
+    if (Ends("at")) {
+      SetTo("ate");
+    } else if (Ends("bl")) {
+      SetTo("ble");
+    } else if (Ends("iz")) {
+      SetTo("ize");
+    } else if (DoubleC(k_)) {
+      k_--;
+      const char ch = b_[k_];
+      if (ch == 'l' || ch == 's' || ch == 'z') {
+        k_++;
+      }
+    } else if (M() == 1 && CVC(k_)) {
+      SetTo("e");
+    }
+  }
+}
+
+// terminal y to i when there is another vowel in the stem
+void PorterStemmer::Step1c() {
+  if (Ends("y") && VowelInStem()) {
+    b_[k_] = 'i';
+  }
+}
+
+// double suffices to single ones
+void PorterStemmer::Step2() {
+  if (k_ < 1) {
+    // no suffix of 2 or more characters
+    return;
+  }
+  switch (b_[k_ - 1]) {
+    case 'a':
+      if (Ends("ational")) {
+        R("ate");
+      } else if (Ends("tional")) {
+        R("tion");
+      }
+      break;
+    case 'c':
+      if (Ends("enci")) {
+        R("ence");
+      } else if (Ends("anci")) {
+        R("ance");
+      }
+      break;
+    case 'e':
+      if (Ends("izer")) {
+        R("ize");
+      }
+      break;
+    case 'l':
+      if (Ends("bli")) {
+        // --DEPARTURE--
+        R("ble");
+      } else if (Ends("alli")) {
+        R("al");
+      } else if (Ends("entli")) {
+        R("ent");
+      } else if (Ends("eli")) {
+        R("e");
+      } else if (Ends("ousli")) {
+        R("ous");
+      }
+      break;
+    case 'o':
+      if (Ends("ization")) {
+        R("ize");
+      } else if (Ends("ation")) {
+        R("ate");
+      } else if (Ends("ator")) {
+        R("ate");
+      }
+      break;
+    case 's':
+      if (Ends("alism")) {
+        R("al");
+      } else if (Ends("iveness")) {
+        R("ive");
+      } else if (Ends("fulness")) {
+        R("ful");
+      } else if (Ends("ousness")) {
+        R("ous");
+      }
+      break;
+    case 't':
+      if (Ends("aliti")) {
+        R("al");
+      } else if (Ends("iviti")) {
+        R("ive");
+      } else if (Ends("biliti")) {
+        R("ble");
+      }
+      break;
+    case 'g':
+      // --DEPARTURE--
+      if (Ends("logi")) {
+        R("log");
+      }
+      break;
+  }
+}
+
+// -ic-, -full, -ness etc.
+void PorterStemmer::Step3() {
+  switch (b_[k_]) {
+    case 'e':
+      if (Ends("icate")) {
+        R("ic");
+      } else if (Ends("ative")) {
+        R("");
+      } else if (Ends("alize")) {
+        R("al");
+      }
+      break;
+    case 'i':
+      if (Ends("iciti")) {
+        R("ic");
+      }
+      break;
+    case 'l':
+      if (Ends("ical")) {
+        R("ic");
+      } else if (Ends("ful")) {
+        R("");
+      }
+      break;
+    case 's':
+      if (Ends("ness")) {
+        R("");
+      }
+      break;
+  }
+}
+
+// -ant, -ence etc. in context <c>vcvc<v>
+void PorterStemmer::Step4() {
+  if (k_ < 1) {
+    return;
+  }
+  switch (b_[k_ - 1]) {
+    case 'a':
+      if (Ends("al")) {
+        break;
+      }
+      return;
+    case 'c':
+      if (Ends("ance") || Ends("ence")) {
+        break;
+      }
+      return;
+    case 'e':
+      if (Ends("er")) {
+        break;
+      }
+      return;
+    case 'i':
+      if (Ends("ic")) {
+        break;
+      }
+      return;
+    case 'l':
+      if (Ends("able") || Ends("ible")) {
+        break;
+      }
+      return;
+    case 'n':
+      if (Ends("ant") || Ends("ement") || Ends("ment") || Ends("ent")) {
+        break;
+      }
+      return;
+    case 'o':
+      if (Ends("ion") && j_ >= 0 && (b_[j_] == 's' || b_[j_] == 't')) {
+        break;
+      }
+      if (Ends("ou")) {
+        // takes care of -ous
+        break;
+      }
+      return;
+    case 's':
+      if (Ends("ism")) {
+        break;
+      }
+      return;
+    case 't':
+      if (Ends("ate") || Ends("iti")) {
+        break;
+      }
+      return;
+    case 'u':
+      if (Ends("ous")) {
+        break;
+      }
+      return;
+    case 'v':
+      if (Ends("ive")) {
+        break;
+      }
+      return;
+    case 'z':
+      if (Ends("ize")) {
+        break;
+      }
+      return;
+    default:
+      return;
+  }
+  if (M() > 1) {
+    k_ = j_;
+  }
+}
+
+// a final -e and -ll to -l if M() > 1
+void PorterStemmer::Step5() {
+  j_ = k_;
+  if (b_[k_] == 'e') {
+    const int a = M();
+    if (a > 1 || (a == 1 && !CVC(k_ - 1))) {
+      k_--;
+    }
+  }
+  if (b_[k_] == 'l' && DoubleC(k_) && M() > 1) {
+    k_--;
+  }
+}
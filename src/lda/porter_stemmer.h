@@ -0,0 +1,46 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// the Porter stemming algorithm
+//
+
+#ifndef SRC_LDA_PORTER_STEMMER_H_
+#define SRC_LDA_PORTER_STEMMER_H_
+
+#include <stddef.h>
+
+// A port of lda-test-data/porter_stemming.py,
+// including its points of DEPARTURE from the published algorithm,
+// so that both give the same stems.
+// Words must be in lower case.
+class PorterStemmer {
+ private:
+  char* b_;  // the word being stemmed
+  int k_;  // offset of its last character
+  int j_;  // a general offset into it
+
+ public:
+  PorterStemmer() : b_(NULL), k_(0), j_(0) {}
+
+  // stem "word" of "length" characters in place,
+  // return the new length
+  int Stem(char* word, int length);
+
+ private:
+  int Cons(int i) const;
+  int M() const;
+  int VowelInStem() const;
+  int DoubleC(int j) const;
+  int CVC(int i) const;
+  int Ends(const char* s);
+  void SetTo(const char* s);
+  void R(const char* s);
+  void Step1ab();
+  void Step1c();
+  void Step2();
+  void Step3();
+  void Step4();
+  void Step5();
+};
+
+#endif  // SRC_LDA_PORTER_STEMMER_H_
@@ -2,6 +2,7 @@
 // Author: Yafei Zhang (zhangyafeikimi@gmail.com)
 //
 
+#include <math.h>
 #include "common/mt19937ar.h"
 #include "common/mt64.h"
 #include "lda/rand.h"
@@ -14,12 +15,76 @@ class RandInializer {
   }
 };
 RandInializer rand_inializer;
-}
+
+#if defined _MSC_VER
+__declspec(thread) RandEngine* thread_engine = NULL;
+#else
+__thread RandEngine* thread_engine = NULL;
+#endif
+}  // namespace
 
 double Rand::Double01() {
+  if (thread_engine) {
+    return thread_engine->Double01();
+  }
   return genrand_real2();
 }
 
 unsigned int Rand::UInt(unsigned int mod) {
+  if (thread_engine) {
+    return thread_engine->UInt(mod);
+  }
   return (unsigned int)genrand_int32() % mod;
 }
+
+void Rand::SetThreadEngine(RandEngine* engine) {
+  thread_engine = engine;
+}
+
+void RandEngine::Seed(uint64_t seed) {
+  // splitmix64 spreads a small seed over the whole state
+  for (int i = 0; i < 2; i++) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    s_[i] = z ^ (z >> 31);
+  }
+}
+
+int RandEngine::Poisson(double mean) {
+  if (mean < 10.0) {
+    // Knuth's multiplication method
+    const double limit = exp(-mean);
+    double prod = Double01();
+    int k = 0;
+    while (prod > limit) {
+      prod *= Double01();
+      k++;
+    }
+    return k;
+  }
+
+  // Hormann's transformed rejection with squeeze(PTRS)
+  const double slam = sqrt(mean);
+  const double loglam = log(mean);
+  const double b = 0.931 + 2.53 * slam;
+  const double a = -0.059 + 0.02483 * b;
+  const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+  const double vr = 0.9277 - 3.6224 / (b - 2);
+  for (;;) {
+    const double U = Double01() - 0.5;
+    const double V = Double01();
+    const double us = 0.5 - fabs(U);
+    const double k = floor((2 * a / us + b) * U + mean + 0.43);
+    if (us >= 0.07 && V <= vr) {
+      return (int)k;
+    }
+    if (k < 0 || (us < 0.013 && V > us)) {
+      continue;
+    }
+    if (log(V) + log(invalpha) - log(a / (us * us) + b)
+        <= -mean + k * loglam - lgamma(k + 1)) {
+      return (int)k;
+    }
+  }
+}
@@ -7,12 +7,56 @@
 #ifndef SRC_LDA_RAND_H_
 #define SRC_LDA_RAND_H_
 
+#include <stdint.h>
+
+class RandEngine;
+
 class Rand {
  public:
   // return value is uniformly in [0, 1)
   static double Double01();
   // return value is uniformly in [9, mod)
   static unsigned int UInt(unsigned int mod);
+  // draw from "engine" in the calling thread instead of the shared
+  // generator, so that samplers may train in several threads at once.
+  // NULL restores the shared one.
+  static void SetThreadEngine(RandEngine* engine);
+};
+
+// A small xorshift128+ generator with its own state,
+// each thread owns one of them, while "Rand" is shared.
+class RandEngine {
+ private:
+  uint64_t s_[2];
+
+ public:
+  explicit RandEngine(uint64_t seed = 0705) {
+    Seed(seed);
+  }
+
+  void Seed(uint64_t seed);
+
+  uint64_t Next() {
+    uint64_t s1 = s_[0];
+    const uint64_t s0 = s_[1];
+    s_[0] = s0;
+    s1 ^= s1 << 23;
+    s_[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+    return s_[1] + s0;
+  }
+
+  // return value is uniformly in [0, 1)
+  double Double01() {
+    return (Next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  // return value is uniformly in [0, mod)
+  unsigned int UInt(unsigned int mod) {
+    return (unsigned int)((Next() >> 32) % mod);
+  }
+
+  // return value follows Poisson(mean)
+  int Poisson(double mean);
 };
 
 #endif  // SRC_LDA_RAND_H_
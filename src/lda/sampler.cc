@@ -2,98 +2,398 @@
 // Author: Yafei Zhang (zhangyafeikimi@gmail.com)
 //
 
-#include "common/line-reader.h"
+#include <algorithm>
+#include <utility>
+#include "common/parallel.h"
 #include "common/x.h"
 #include "lda/rand.h"
 #include "lda/sampler.h"
 
 SamplerBase::~SamplerBase() {}
 
-void SamplerBase::LoadCorpus(FILE* fp, int with_id) {
-  LineReader line_reader;
-  int line_no = 0;
-  char* endptr;
+namespace {
+
+// strtok without hidden state
+char* NextToken(char** cursor) {
+  char* begin = *cursor + strspn(*cursor, DELIMITER);
+  if (*begin == '\0') {
+    *cursor = begin;
+    return NULL;
+  }
+  char* end = begin + strcspn(begin, DELIMITER);
+  if (*end != '\0') {
+    *end++ = '\0';
+  }
+  *cursor = end;
+  return begin;
+}
+
+// bytes of the corpus read at once
+const size_t kLoadBlockBytes = 16 * 1048576;
+
+// docs parsed by one thread from a range of a block
+struct CorpusChunk {
+  std::vector<Doc> docs;  // indices in "words"
+  std::vector<int> words;
+  std::vector<char> ids;  // ids of "docs", '\0' terminated
+  std::vector<size_t> id_offsets;  // offsets in "ids"
+  int V;
+  CorpusChunk() : V(0) {}
+};
+
+// parse lines in [begin, end), the first of which is line "line_no"
+void ParseChunk(char* begin, char* end, int line_no,
+                int with_id, int sort_tokens, CorpusChunk* chunk) {
   char* doc_id = NULL;
+  Doc doc;
+
+  while (begin < end) {
+    char* line_end = (char*)memchr(begin, '\n', end - begin);
+    if (line_end == NULL) {
+      // the last line of the corpus, followed by a '\0'
+      line_end = end;
+    }
+    *line_end = '\0';
+
+    doc.index = (TokenIndex)chunk->words.size();
+    doc.N = ParseDoc(begin, line_no, with_id, &doc_id, &chunk->words);
+    if (doc.N) {
+      if (sort_tokens) {
+        // put the same words together,
+        // so samplers reuse their states of a word in its run of tokens
+        std::sort(chunk->words.begin() + doc.index, chunk->words.end());
+      }
+      for (int n = 0; n < doc.N; n++) {
+        const int v = chunk->words[doc.index + n];
+        if (v >= chunk->V) {
+          chunk->V = v + 1;
+        }
+      }
+      if (with_id) {
+        chunk->id_offsets.push_back(chunk->ids.size());
+        chunk->ids.insert(chunk->ids.end(),
+                          doc_id, doc_id + strlen(doc_id) + 1);
+      }
+      chunk->docs.push_back(doc);
+    }
+
+    begin = line_end + 1;
+    line_no++;
+  }
+}
+
+// split lines in [begin, end) into ranges for threads and parse them,
+// "*line_no" is the number of lines before "begin"
+void ParseBlock(char* begin, char* end, int with_id, int sort_tokens,
+                int* line_no, std::vector<CorpusChunk*>* chunks) {
+  const int threads = GetMaxThreads();
+  // ranges[i]...ranges[i + 1]: range of thread i, ends after a '\n'
+  std::vector<char*> ranges(threads + 1);
+  ranges[0] = begin;
+  for (int i = 1; i < threads; i++) {
+    char* split = begin + (end - begin) / threads * i;
+    if (split < ranges[i - 1]) {
+      split = ranges[i - 1];
+    }
+    char* newline = (char*)memchr(split, '\n', end - split);
+    ranges[i] = newline ? newline + 1 : end;
+  }
+  ranges[threads] = end;
+
+  std::vector<int> lines(threads + 1, 0);
+  int i;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < threads; i++) {
+    const char* p = ranges[i];
+    int n = 0;
+    while (p < ranges[i + 1]) {
+      const char* newline = (const char*)memchr(p, '\n', ranges[i + 1] - p);
+      n++;
+      p = newline ? newline + 1 : ranges[i + 1];
+    }
+    lines[i + 1] = n;
+  }
+  lines[0] = *line_no + 1;
+  for (i = 0; i < threads; i++) {
+    lines[i + 1] += lines[i];
+  }
+
+  const size_t first = chunks->size();
+  for (i = 0; i < threads; i++) {
+    chunks->push_back(new CorpusChunk);
+  }
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < threads; i++) {
+    ParseChunk(ranges[i], ranges[i + 1], lines[i],
+               with_id, sort_tokens, (*chunks)[first + i]);
+  }
+  *line_no = lines[threads] - 1;
+}
+
+}  // namespace
+
+int ParseDoc(char* line, int line_no, int with_id,
+             char** doc_id, std::vector<int>* words) {
+  char* endptr;
   char* word_id;
   char* word_count;
-  char* word_begin;
-  Doc doc;
-  Word word;
+  char* cursor = line;
   int id, i, count;
+  int N = 0;
 
-  Log("Loading corpus.\n");
-  V_ = 0;
-  while (line_reader.ReadLine(fp) != NULL) {
-    line_no++;
+  if (with_id) {
+    *doc_id = NextToken(&cursor);
+    if (*doc_id == NULL) {
+      Error("line %d, empty line.\n", line_no);
+      return 0;
+    }
+  }
 
-    doc.index = (int)words_.size();
-    doc.N = 0;
+  for (;;) {
+    word_id = NextToken(&cursor);
+    if (word_id == NULL) {
+      break;
+    }
 
-    if (with_id) {
-      doc_id = strtok(line_reader.buf, DELIMITER);
-      if (doc_id == NULL) {
-        Error("line %d, empty line.\n", line_no);
+    word_count = strrchr(word_id, ':');
+    if (word_count) {
+      if (word_count == word_id) {
+        Error("line %d, word id is empty.\n", line_no);
+        continue;
+      }
+      *word_count = '\0';
+      word_count++;
+      count = (int)strtoll(word_count, &endptr, 10);
+      if (*endptr != '\0') {
+        Error("line %d, word count error \"%s\".\n", line_no, word_count);
         continue;
       }
-      word_begin = NULL;
     } else {
-      word_begin = line_reader.buf;
+      count = 1;
     }
 
-    for (;;) {
-      word_id = strtok(word_begin, DELIMITER);
-      word_begin = NULL;
-      if (word_id == NULL) {
-        break;
-      }
+    id = (int)strtoll(word_id, &endptr, 10);
+    if (*endptr != '\0') {
+      Error("line %d, word id error \"%s\".\n", line_no, word_id);
+      continue;
+    }
+    if (id == 0) {
+      Error("line %d, word id must start from 1.\n", line_no);
+      continue;
+    }
 
-      word_count = strrchr(word_id, ':');
-      if (word_count) {
-        if (word_count == word_id) {
-          Error("line %d, word id is empty.\n", line_no);
-          continue;
-        }
-        *word_count = '\0';
-        word_count++;
-        count = (int)strtoll(word_count, &endptr, 10);
-        if (*endptr != '\0') {
-          Error("line %d, word count error \"%s\".\n", line_no, word_count);
-          continue;
-        }
-      } else {
-        count = 1;
-      }
+    for (i = 0; i < count; i++) {
+      words->push_back(id - 1);
+      N++;
+    }
+  }
+  return N;
+}
 
-      id = (int)strtoll(word_id, &endptr, 10);
-      if (*endptr != '\0') {
-        Error("line %d, word id error \"%s\".\n", line_no, word_id);
-        continue;
+void SamplerBase::LoadCorpus(FILE* fp, int with_id) {
+  Corpus& corpus = own_corpus_;
+  std::vector<CorpusChunk*> chunks;
+  std::vector<char> block;
+  size_t carry = 0;  // bytes of an unfinished line in front of "block"
+  int line_no = 0;
+
+  Log("Loading corpus.\n");
+  for (;;) {
+    // one more byte for a '\0' after the last line
+    block.resize(carry + kLoadBlockBytes + 1);
+    const size_t size = carry + fread(&block[carry], 1, kLoadBlockBytes, fp);
+    const int eof = size < carry + kLoadBlockBytes;
+    size_t end = size;
+    if (eof) {
+      block[end] = '\0';
+    } else {
+      while (end > 0 && block[end - 1] != '\n') {
+        end--;
       }
-      if (id == 0) {
-        Error("line %d, word id must start from 1.\n", line_no);
+      if (end == 0) {
+        // a line longer than a block
+        carry = size;
         continue;
       }
+    }
+
+    ParseBlock(&block[0], &block[0] + end, with_id, sort_tokens_,
+               &line_no, &chunks);
+
+    if (eof) {
+      break;
+    }
+    carry = size - end;
+    memmove(&block[0], &block[end], carry);
+  }
+  std::vector<char>().swap(block);
+
+  // concatenate chunks into presized arrays,
+  // freeing each once copied to bound the peak memory
+  size_t total_words = corpus.words.size();
+  size_t total_docs = corpus.docs.size();
+  size_t total_id_bytes = corpus.doc_id_buf.size();
+  for (size_t i = 0; i < chunks.size(); i++) {
+    total_words += chunks[i]->words.size();
+    total_docs += chunks[i]->docs.size();
+    total_id_bytes += chunks[i]->ids.size();
+  }
+#if !defined LDA_64BIT_TOKENS
+  if (total_words > 0x7fffffff) {
+    Error("%.0lf tokens exceed 2^31 - 1, rebuild with LDA_64BIT_TOKENS.\n",
+          (double)total_words);
+    exit(1);
+  }
+#endif
+  corpus.words.reserve(total_words);
+  corpus.docs.reserve(total_docs);
+  corpus.doc_id_buf.reserve(total_id_bytes);
+  if (with_id) {
+    corpus.doc_id_offsets.reserve(total_docs);
+  }
 
-      if (id > V_) {
-        V_ = id;
+  V_ = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    CorpusChunk* chunk = chunks[i];
+    const TokenIndex index = (TokenIndex)corpus.words.size();
+    const size_t id_offset = corpus.doc_id_buf.size();
+    corpus.words.insert(corpus.words.end(),
+                        chunk->words.begin(), chunk->words.end());
+    for (size_t j = 0; j < chunk->docs.size(); j++) {
+      Doc doc = chunk->docs[j];
+      doc.index += index;
+      corpus.docs.push_back(doc);
+    }
+    if (with_id) {
+      corpus.doc_id_buf.insert(corpus.doc_id_buf.end(),
+                         chunk->ids.begin(), chunk->ids.end());
+      for (size_t j = 0; j < chunk->id_offsets.size(); j++) {
+        corpus.doc_id_offsets.push_back(id_offset + chunk->id_offsets[j]);
       }
-      word.v = id - 1;
-      for (i = 0; i < count; i++) {
-        words_.push_back(word);
-        doc.N++;
+    }
+    if (chunk->V > V_) {
+      V_ = chunk->V;
+    }
+    delete chunk;
+  }
+
+  M_ = (int)corpus.docs.size();
+  Log("Loaded %d documents with a %d-size vocabulary.\n", M_, V_);
+
+  if (remap_words_) {
+    RemapWords();
+  }
+  // compress before allocating topics, so that both arrays of word ids
+  // never stay in memory together with topics
+  const size_t T = corpus.words.size();
+  if (compress_words_) {
+    CompressWords();
+  }
+  topics_.resize(T);
+}
+
+void SamplerBase::RemapWords() {
+  Corpus& corpus = own_corpus_;
+  std::vector<TokenIndex> word_count(V_, 0);
+  std::vector<int> doc_freq(V_, 0);
+  std::vector<int> last_doc(V_, -1);
+  for (int m = 0; m < M_; m++) {
+    const Doc& doc = corpus.docs[m];
+    for (int n = 0; n < doc.N; n++) {
+      const int v = corpus.words[doc.index + n];
+      word_count[v]++;
+      if (last_doc[v] != m) {
+        last_doc[v] = m;
+        doc_freq[v]++;
       }
     }
+  }
 
-    if (doc.N) {
-      if (with_id) {
-        doc_ids_.push_back(doc_id);
+  std::vector<int> stopped(V_, 0);
+  for (size_t i = 0; i < stop_words_.size(); i++) {
+    const int v = stop_words_[i] - 1;
+    if (v >= 0 && v < V_) {
+      stopped[v] = 1;
+    }
+  }
+
+  // (-count, original id) of kept words, sorted to put frequent words first
+  std::vector<std::pair<TokenIndex, int> > kept;
+  const double max_docs = max_doc_freq_ * M_;
+  for (int v = 0; v < V_; v++) {
+    if (word_count[v] == 0
+        || word_count[v] < min_word_count_
+        || doc_freq[v] > max_docs
+        || stopped[v]) {
+      continue;
+    }
+    kept.push_back(std::make_pair(-word_count[v], v));
+  }
+  std::sort(kept.begin(), kept.end());
+
+  const int new_V = (int)kept.size();
+  std::vector<int> new_ids(V_, -1);
+  word_map_.resize(new_V);
+  for (int v = 0; v < new_V; v++) {
+    word_map_[v] = kept[v].second;
+    new_ids[kept[v].second] = v;
+  }
+
+  // rewrite tokens in place, dropping pruned words and docs left empty
+  TokenIndex index = 0;
+  int new_M = 0;
+  for (int m = 0; m < M_; m++) {
+    Doc doc = corpus.docs[m];
+    const TokenIndex begin = index;
+    for (int n = 0; n < doc.N; n++) {
+      const int v = new_ids[corpus.words[doc.index + n]];
+      if (v != -1) {
+        corpus.words[index++] = v;
       }
-      docs_.push_back(doc);
     }
+    if (index == begin) {
+      continue;
+    }
+    doc.index = begin;
+    doc.N = (int)(index - begin);
+    corpus.docs[new_M] = doc;
+    if (!corpus.doc_id_offsets.empty()) {
+      corpus.doc_id_offsets[new_M] = corpus.doc_id_offsets[m];
+    }
+    new_M++;
   }
 
-  M_ = (int)docs_.size();
-  Log("Loaded %d documents with a %d-size vocabulary.\n", M_, V_);
+  const TokenIndex pruned_tokens = (TokenIndex)corpus.words.size() - index;
+  corpus.words.resize(index);
+  corpus.docs.resize(new_M);
+  if (!corpus.doc_id_offsets.empty()) {
+    corpus.doc_id_offsets.resize(new_M);
+  }
+
+  Log("Remapped vocabulary to %d words, "
+      "pruned %d words, %.0lf tokens and %d documents.\n",
+      new_V, V_ - new_V, (double)pruned_tokens, M_ - new_M);
+  original_V_ = V_;
+  V_ = new_V;
+  M_ = new_M;
+}
+
+void SamplerBase::ShareCorpus(const SamplerBase& source) {
+  corpus_ = source.corpus_;
+  M_ = source.M_;
+  V_ = source.V_;
+  word_map_ = source.word_map_;
+  original_V_ = source.original_V_;
+  topics_.resize(source.topics_.size());
+}
+
+void SamplerBase::CompressWords() {
+  Corpus& corpus = own_corpus_;
+  const double before = corpus.words.size() * sizeof(int) / 1048576.0;
+  corpus.compressed_words.Build(corpus.docs, &corpus.words);
+  std::vector<int>().swap(corpus.words);
+  Log("Compressed word ids from %.1lfMB to %.1lfMB.\n",
+      before, corpus.compressed_words.bytes() / 1048576.0);
 }
 
 void SamplerBase::SaveModel(const std::string& prefix) const {
@@ -107,36 +407,65 @@ void SamplerBase::SaveModel(const std::string& prefix) const {
     fprintf(fp, "K=%d\n", K_);
   }
   {
-    // theta_mk[m][k]: doc m's topic k' proportion
-    Array2D<double> theta_mk;
-    theta_mk.Init(M_, K_);
-    CollectTheta(&theta_mk);
+    // theta_m[k]: doc m's topic k' proportion
+    std::vector<double> theta_m(K_);
 
     filename = prefix + "-doc-topic";
     ScopedFile fp(filename.c_str(), ScopedFile::Write);
     for (int m = 0; m < M_; m++) {
-      if (!doc_ids_.empty()) {
-        fprintf(fp, "%s ", doc_ids_[m].c_str());
+      CollectTheta(m, &theta_m[0]);
+      if (!corpus_->doc_id_offsets.empty()) {
+        fprintf(fp, "%s ", &corpus_->doc_id_buf[corpus_->doc_id_offsets[m]]);
       }
       for (int k = 0; k < K_ - 1; k++) {
-        fprintf(fp, "%lg ", theta_mk[m][k]);
+        fprintf(fp, "%lg ", theta_m[k]);
       }
-      fprintf(fp, "%lg\n", theta_mk[m][K_ - 1]);
+      fprintf(fp, "%lg\n", theta_m[K_ - 1]);
     }
   }
   {
-    // phi_k[k][v]: the probability that word v is assigned to topic k
-    Array2D<double> phi_kv;
-    phi_kv.Init(K_, V_);
-    CollectPhi(&phi_kv);
+    // phi_k[v]: the probability that word v is assigned to topic k
+    std::vector<double> phi_k(V_);
+
+    // columns are original word ids, pruned words are 0
+    const int columns = word_map_.empty() ? V_ : original_V_;
+    std::vector<int> column_words(columns);
+    if (word_map_.empty()) {
+      for (int v = 0; v < V_; v++) {
+        column_words[v] = v;
+      }
+    } else {
+      column_words.assign(columns, -1);
+      for (int v = 0; v < V_; v++) {
+        column_words[word_map_[v]] = v;
+      }
+    }
 
     filename = prefix + "-topic-word";
     ScopedFile fp(filename.c_str(), ScopedFile::Write);
     for (int k = 0; k < K_; k++) {
-      for (int v = 0; v < V_ - 1; v++) {
-        fprintf(fp, "%lg ", phi_kv[k][v]);
+      CollectPhi(k, &phi_k[0]);
+      for (int u = 0; u < columns; u++) {
+        const int v = column_words[u];
+        fprintf(fp, u == columns - 1 ? "%lg\n" : "%lg ",
+                v == -1 ? 0.0 : phi_k[v]);
       }
-      fprintf(fp, "%lg\n", phi_kv[k][V_ - 1]);
+    }
+  }
+  if (!topic_map_.empty()) {
+    // line k: original id of topic k, starts from 0
+    filename = prefix + "-topic-map";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (int k = 0; k < K_; k++) {
+      fprintf(fp, "%d\n", topic_map_[k]);
+    }
+  }
+  if (!word_map_.empty()) {
+    // line v: original id of word v
+    filename = prefix + "-word-map";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (int v = 0; v < V_; v++) {
+      fprintf(fp, "%d\n", word_map_[v] + 1);
     }
   }
   {
@@ -154,9 +483,121 @@ void SamplerBase::SaveModel(const std::string& prefix) const {
   Log("Done.\n");
 }
 
+int SamplerBase::PlanMemory() {
+  // K * (1 - miss^n) is the expected # of distinct topics
+  // of n tokens with uniformly random topics
+  const double miss = 1.0 - 1.0 / K_;
+  int n;
+
+  // rows of docs, then rows of words
+  const int types = kOrderedSparseHist + 1;
+  std::vector<double> tables(types, 0.0);
+  int type;
+  for (int m = 0; m < M_; m++) {
+    n = corpus_->docs[m].N;
+    if (n <= implicit_doc_len_) {
+      continue;
+    }
+    const double nnz = K_ * (1.0 - pow(miss, n));
+    for (type = kDenseHist; type < types; type++) {
+      tables[type] += IntTables::RowBytes(type, nnz, K_);
+    }
+  }
+
+  std::vector<TokenIndex> word_count(V_, 0);
+  for (int m = 0; m < M_; m++) {
+    const int* word = DocWords(m, &doc_words_);
+    for (n = 0; n < corpus_->docs[m].N; n++) {
+      ++word_count[word[n]];
+    }
+  }
+  if (implicit_doc_len_ > 0) {
+    for (type = kDenseHist; type < types; type++) {
+      tables[type] += (double)M_ * sizeof(int);
+    }
+  }
+  double word_nnz = 0.0;
+  for (int v = 0; v < V_; v++) {
+    const double nnz = K_ * (1.0 - pow(miss, (double)word_count[v]));
+    word_nnz += nnz;
+    for (type = kDenseHist; type < types; type++) {
+      tables[type] += IntTables::RowBytes(type, nnz, K_);
+    }
+  }
+
+  // loaded already, a shared corpus is counted by its loader
+  double corpus = (double)topics_.capacity() * sizeof(Topic);
+  if (corpus_ == &own_corpus_) {
+    corpus += (double)corpus_->words.capacity() * sizeof(int)
+              + corpus_->compressed_words.bytes()
+              + (double)corpus_->docs.capacity() * sizeof(Doc)
+              + corpus_->doc_id_buf.capacity()
+              + (double)corpus_->doc_id_offsets.capacity() * sizeof(size_t);
+  }
+  // rows of theta and phi of "SaveModel" and O(K) arrays
+  const double others = (V_ + K_ * 8.0) * sizeof(double);
+  double sampler = SamplerBytes(word_nnz);
+  double total = corpus + tables[storage_type_] + sampler + others;
+  Log("Planned memory: corpus %.1lfMB, tables %.1lfMB, sampler %.1lfMB, "
+      "%.1lfMB in all.\n",
+      corpus / 1048576.0, tables[storage_type_] / 1048576.0,
+      sampler / 1048576.0, total / 1048576.0);
+
+  const double limit = memory_limit_ * 1048576.0;
+  if (memory_limit_ == 0 || total <= limit) {
+    return 0;
+  }
+
+  int smallest = storage_type_;
+  for (type = kDenseHist; type < types; type++) {
+    if (tables[type] < tables[smallest]) {
+      smallest = type;
+    }
+  }
+  if (smallest != storage_type_) {
+    Log("Switching storage type from %d to %d, "
+        "whose tables are planned in %.1lfMB.\n",
+        storage_type_, smallest, tables[smallest] / 1048576.0);
+    storage_type_ = smallest;
+    total = corpus + tables[storage_type_] + sampler + others;
+  }
+
+  if (total > limit
+      && LimitSamplerBytes(limit - (total - sampler), word_nnz) == 0) {
+    sampler = SamplerBytes(word_nnz);
+    total = corpus + tables[storage_type_] + sampler + others;
+    Log("Limited caches of the sampler to %.1lfMB.\n", sampler / 1048576.0);
+  }
+
+  if (total > limit) {
+    Error("Planned memory %.1lfMB exceeds the limit %dMB.\n",
+          total / 1048576.0, memory_limit_);
+    return -1;
+  }
+  return 0;
+}
+
+double SamplerBase::SamplerBytes(double word_nnz) const {
+  return 0.0;
+}
+
+int SamplerBase::LimitSamplerBytes(double bytes, double word_nnz) {
+  return -1;
+}
+
+int SamplerBase::DocRowThreads() const {
+  return 1;
+}
+
 int SamplerBase::Initialize() {
+  if (K_ > kMaxTopics) {
+    Error("K must not exceed %d with %d-bit topic ids.\n",
+          kMaxTopics, (int)(8 * sizeof(Topic)));
+    return -1;
+  }
+
   if (hp_sum_alpha_ <= 0.0) {
-    double avg_doc_len = (double)words_.size() / docs_.size();
+    double avg_doc_len = (double)topics_.size() / corpus_->docs.size();
     hp_alpha_.resize(K_, avg_doc_len / K_);
     hp_sum_alpha_ = avg_doc_len;
   } else {
@@ -169,6 +610,10 @@ int SamplerBase::Initialize() {
   }
   hp_sum_beta_ = V_ * hp_beta_;
 
+  if (PlanMemory() != 0) {
+    return -1;
+  }
+
   if (hp_opt_) {
     if (hp_opt_interval_ == 0) {
       hp_opt_interval_ = 5;
@@ -189,71 +634,215 @@ int SamplerBase::Initialize() {
   }
   iteration_ = 1;
 
-  topics_count_.Init(K_);
-  docs_topics_count_.Init(M_, K_, storage_type_);
-  words_topics_count_.Init(V_, K_, storage_type_);
+  // short docs keep no row
+  doc_rows_.clear();
+  if (implicit_doc_len_ > 0) {
+    doc_rows_.resize(M_);
+    int rows = 0;
+    for (int m = 0; m < M_; m++) {
+      doc_rows_[m] = corpus_->docs[m].N <= implicit_doc_len_ ? -1 : rows++;
+    }
+    Log("%d of %d docs keep doc-topic counts.\n", rows, M_);
+  }
 
   // random initialize topics
-  for (int m = 0; m < M_; m++) {
-    const Doc& doc = docs_[m];
-    Word* word = &words_[doc.index];
-    IntTable& doc_m_topics_count = docs_topics_count_[m];
-    for (int n = 0; n < doc.N; n++, word++) {
-      const int v = word->v;
-      const int new_topic = (int)Rand::UInt(K_);
-      word->k = new_topic;
-      ++topics_count_[new_topic];
-      ++doc_m_topics_count[new_topic];
-      ++words_topics_count_[v][new_topic];
-    }
+  for (size_t i = 0; i < topics_.size(); i++) {
+    topics_[i] = (Topic)Rand::UInt(K_);
   }
+  CountTopics();
 
   const double llh = LogLikelihood();
-  Log("LogLikelihood(total/word)=%lg/%lg\n", llh, llh / words_.size());
+  Log("LogLikelihood(total/word)=%lg/%lg\n", llh, llh / topics_.size());
   return 0;
 }
 
-int SamplerBase::InitializeSampler() {
-  return 0;
-}
+void SamplerBase::CountTopics() {
+  int rows = M_;
+  if (!doc_rows_.empty()) {
+    rows = (int)(doc_rows_.size()
+                 - std::count(doc_rows_.begin(), doc_rows_.end(), -1));
+  }
+  topics_count_.Init(K_);
+  docs_topics_count_.Init(rows, K_, storage_type_, huge_pages_,
+                          DocRowThreads());
+  words_topics_count_.Init(V_, K_, storage_type_, huge_pages_);
 
-void SamplerBase::CollectTheta(Array2D<double>* theta) const {
   for (int m = 0; m < M_; m++) {
-    const Doc& doc = docs_[m];
-    const IntTable& doc_m_topics_count = docs_topics_count_[m];
-    double* theta_m = (*theta)[m];
-    for (int k = 0; k < K_; k++) {
-      theta_m[k] = (doc_m_topics_count[k] + hp_alpha_[k])
-                   / (doc.N + hp_sum_alpha_);
+    const Doc& doc = corpus_->docs[m];
+    const int* word = DocWords(m, &doc_words_);
+    const Topic* topic = &topics_[doc.index];
+    const int row = DocRow(m);
+    for (int n = 0; n < doc.N; n++, word++, topic++) {
+      const int k = *topic;
+      ++topics_count_[k];
+      if (row >= 0) {
+        ++docs_topics_count_[row][k];
+      }
+      ++words_topics_count_[*word][k];
     }
   }
 }
 
-void SamplerBase::CollectPhi(Array2D<double>* phi) const {
-  for (int k = 0; k < K_; k++) {
-    const int topics_count_k = topics_count_[k];
-    double* phi_k = (*phi)[k];
-    for (int v = 0; v < V_; v++) {
-      phi_k[v] = (words_topics_count_[v][k] + hp_beta_)
-                 / (topics_count_k + hp_sum_beta_);
+int SamplerBase::CompactTopics() {
+  // new_ids[k]: new id of topic k, -1 if it is dropped
+  std::vector<int> new_ids(K_, -1);
+  std::vector<int> old_ids;
+  int k;
+  for (k = 0; k < K_; k++) {
+    if (topics_count_[k] > min_topic_count_) {
+      new_ids[k] = (int)old_ids.size();
+      old_ids.push_back(k);
+    }
+  }
+  const int K = (int)old_ids.size();
+  if (K == K_ || K == 0) {
+    return 0;
+  }
+  Log("Compacting topics from %d to %d.\n", K_, K);
+
+  for (size_t i = 0; i < topics_.size(); i++) {
+    k = new_ids[topics_[i]];
+    if (k == -1) {
+      k = (int)Rand::UInt(K);
+    }
+    topics_[i] = (Topic)k;
+  }
+
+  hp_sum_alpha_ = 0.0;
+  for (k = 0; k < K; k++) {
+    hp_alpha_[k] = hp_alpha_[old_ids[k]];
+    hp_sum_alpha_ += hp_alpha_[k];
+  }
+  hp_alpha_.resize(K);
+
+  if (topic_map_.empty()) {
+    topic_map_.swap(old_ids);
+  } else {
+    for (k = 0; k < K; k++) {
+      old_ids[k] = topic_map_[old_ids[k]];
     }
+    topic_map_.swap(old_ids);
+  }
+
+  K_ = K;
+  CountTopics();
+  return 1;
+}
+
+void SamplerBase::InitializeWordTokens() {
+  if (!word_tokens_.empty()) {
+    return;
+  }
+
+  const TokenIndex T = (TokenIndex)topics_.size();
+  int m, n;
+
+  // counting sort tokens by word id
+  word_offsets_.assign(V_ + 1, 0);
+  for (m = 0; m < M_; m++) {
+    const int* word = DocWords(m, &doc_words_);
+    for (n = 0; n < corpus_->docs[m].N; n++) {
+      ++word_offsets_[word[n] + 1];
+    }
+  }
+  for (int v = 0; v < V_; v++) {
+    word_offsets_[v + 1] += word_offsets_[v];
+  }
+
+  std::vector<TokenIndex> next(word_offsets_.begin(),
+                               word_offsets_.end() - 1);
+  word_tokens_.resize(T);
+  token_docs_.resize(T);
+  for (m = 0; m < M_; m++) {
+    const Doc& doc = corpus_->docs[m];
+    const int* word = DocWords(m, &doc_words_);
+    for (n = 0; n < doc.N; n++) {
+      word_tokens_[next[word[n]]++] = doc.index + n;
+      token_docs_[doc.index + n] = m;
+    }
+  }
+}
+
+double SamplerBase::WordTokensBytes() const {
+  // "word_offsets_" and a copy of it while building
+  return (double)topics_.size() * (sizeof(TokenIndex) + sizeof(int))
+         + (V_ + 1.0) * sizeof(TokenIndex) * 2;
+}
+
+int SamplerBase::InitializeSampler() {
+  return 0;
+}
+
+void SamplerBase::CollectTheta(int m, double* theta_m) const {
+  const Doc& doc = corpus_->docs[m];
+  ImplicitDocTopicsCount implicit;
+  const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+  for (int k = 0; k < K_; k++) {
+    theta_m[k] = (doc_m_topics_count[k] + hp_alpha_[k])
+                 / (doc.N + hp_sum_alpha_);
+  }
+}
+
+void SamplerBase::CollectPhi(int k, double* phi_k) const {
+  const TokenIndex topics_count_k = topics_count_[k];
+  for (int v = 0; v < V_; v++) {
+    phi_k[v] = (words_topics_count_[v][k] + hp_beta_)
+               / (topics_count_k + hp_sum_beta_);
   }
 }
 
 double SamplerBase::LogLikelihood() const {
+  // sum_k (N_mk + alpha_k) * (N_vk + beta) / (N_k + sum_beta)
+  // = sum_k alpha_k * beta / (N_k + sum_beta)  [smooth]
+  // + sum_k alpha_k * N_vk / (N_k + sum_beta)  [word_sums[v]]
+  // + sum_k N_mk * (N_vk + beta) / (N_k + sum_beta),  [doc]
+  // the latter two over nonzero counts
+  std::vector<double> inv_topics_count(K_);
+  double smooth = 0.0;
+  int k;
+  for (k = 0; k < K_; k++) {
+    inv_topics_count[k] = 1.0 / (topics_count_[k] + hp_sum_beta_);
+    smooth += hp_alpha_[k] * hp_beta_ * inv_topics_count[k];
+  }
+
+  std::vector<double> word_sums(V_, 0.0);
+  for (int v = 0; v < V_; v++) {
+    const IntTable& word_v_topics_count = words_topics_count_[v];
+    IntTable::const_iterator first = word_v_topics_count.begin();
+    IntTable::const_iterator last = word_v_topics_count.end();
+    for (; first != last; ++first) {
+      k = first.id();
+      word_sums[v] += hp_alpha_[k] * first.count() * inv_topics_count[k];
+    }
+  }
+
+  std::vector<int> buffer;
+  // N_mk / (N_k + sum_beta) of doc m's nonzero topics
+  std::vector<std::pair<int, double> > doc_items;
   double sum = 0.0;
   for (int m = 0; m < M_; m++) {
-    const Doc& doc = docs_[m];
-    const Word* word = &words_[doc.index];
-    const IntTable& doc_m_topics_count = docs_topics_count_[m];
+    const Doc& doc = corpus_->docs[m];
+    const int* word = DocWords(m, &buffer);
+    ImplicitDocTopicsCount implicit;
+    const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+    IntTable::const_iterator first = doc_m_topics_count.begin();
+    IntTable::const_iterator last = doc_m_topics_count.end();
+    double doc_smooth = 0.0;
+    doc_items.clear();
+    for (; first != last; ++first) {
+      k = first.id();
+      const double item = first.count() * inv_topics_count[k];
+      doc_items.push_back(std::make_pair(k, item));
+      doc_smooth += item * hp_beta_;
+    }
+
     for (int n = 0; n < doc.N; n++, word++) {
-      const int v = word->v;
+      const int v = *word;
       const IntTable& word_v_topics_count = words_topics_count_[v];
-      double word_sum = 0.0;
-      for (int k = 0; k < K_; k++) {
-        word_sum += (doc_m_topics_count[k] + hp_alpha_[k])
-                    * (word_v_topics_count[k] + hp_beta_)
-                    / (topics_count_[k] + hp_sum_beta_);
+      double word_sum = smooth + word_sums[v] + doc_smooth;
+      for (size_t i = 0; i < doc_items.size(); i++) {
+        word_sum += doc_items[i].second
+                    * word_v_topics_count[doc_items[i].first];
       }
       word_sum /= (doc.N + hp_sum_alpha_);
       sum += log(word_sum);
@@ -275,6 +864,11 @@ int SamplerBase::Train() {
     PreSampleCorpus();
     SampleCorpus();
     PostSampleCorpus();
+    if (compact_topics_interval_
+        && iteration_ % compact_topics_interval_ == 0
+        && CompactTopics() && InitializeSampler() != 0) {
+      return -2;
+    }
   }
   return 0;
 }
@@ -286,13 +880,30 @@ void SamplerBase::PreSampleCorpus() {
 
 void SamplerBase::PostSampleCorpus() {
   HPOpt_Optimize();
-  if (iteration_ > burnin_iteration_
+  if (compact_interval_ && iteration_ % compact_interval_ == 0) {
+    CompactTables();
+  }
+  if (iteration_ > burnin_iteration_ && log_likelihood_interval_
       && iteration_ % log_likelihood_interval_ == 0) {
     const double llh = LogLikelihood();
-    Log("LogLikelihood(total/word)=%lg/%lg\n", llh, llh / words_.size());
+    Log("LogLikelihood(total/word)=%lg/%lg\n", llh, llh / topics_.size());
   }
 }
 
+void SamplerBase::CompactTables() {
+  const size_t before = docs_topics_count_.used()
+                        + words_topics_count_.used();
+  if (before == 0) {
+    return;
+  }
+  docs_topics_count_.Compact();
+  words_topics_count_.Compact();
+  const size_t after = docs_topics_count_.used()
+                       + words_topics_count_.used();
+  Log("Compacted tables from %.1lfMB to %.1lfMB.\n",
+      before / 1048576.0, after / 1048576.0);
+}
+
 void SamplerBase::SampleCorpus() {
   for (int m = 0; m < M_; m++) {
     PreSampleDocument(m);
@@ -368,9 +979,12 @@ void SamplerBase::HPOpt_OptimizeAlpha() {
 
 void SamplerBase::HPOpt_PrepareOptimizeBeta() {
   for (int m = 0; m < M_; m++) {
-    const IntTable& doc_m_topics_count = docs_topics_count_[m];
-    for (int k = 0; k < K_; k++) {
-      const int count = doc_m_topics_count[k];
+    ImplicitDocTopicsCount implicit;
+    const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+    IntTable::const_iterator first = doc_m_topics_count.begin();
+    IntTable::const_iterator last = doc_m_topics_count.end();
+    for (; first != last; ++first) {
+      const int count = first.count();
       if (count == 0) {
         continue;
       }
@@ -382,11 +996,11 @@ void SamplerBase::HPOpt_PrepareOptimizeBeta() {
   }
 
   for (int k = 0; k < K_; k++) {
-    const int count = topics_count_[k];
+    const TokenIndex count = topics_count_[k];
     if (count == 0) {
       continue;
     }
-    if ((int)topic_len_hist_.size() <= count) {
+    if ((TokenIndex)topic_len_hist_.size() <= count) {
       topic_len_hist_.resize(count + 1);
     }
     ++topic_len_hist_[count];
@@ -420,14 +1034,18 @@ void SamplerBase::HPOpt_PostSampleDocument(int m) {
   }
 
   if (hp_opt_alpha_iteration_ > 0) {
-    const Doc& doc = docs_[m];
-    const IntTable& doc_m_topics_count = docs_topics_count_[m];
-    for (int k = 0; k < K_; k++) {
-      const int count = doc_m_topics_count[k];
+    const Doc& doc = corpus_->docs[m];
+    ImplicitDocTopicsCount implicit;
+    const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+    IntTable::const_iterator first = doc_m_topics_count.begin();
+    IntTable::const_iterator last = doc_m_topics_count.end();
+    for (; first != last; ++first) {
+      const int count = first.count();
       if (count == 0) {
         continue;
       }
-      std::vector<int>& docs_topic_k_count_hist = docs_topic_count_hist_[k];
+      std::vector<int>& docs_topic_k_count_hist =
+        docs_topic_count_hist_[first.id()];
       if ((int)docs_topic_k_count_hist.size() <= count) {
         docs_topic_k_count_hist.resize(count + 1);
       }
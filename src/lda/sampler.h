@@ -7,40 +7,94 @@
 #ifndef SRC_LDA_SAMPLER_H_
 #define SRC_LDA_SAMPLER_H_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string>
+#include <utility>
 #include <vector>
 #include "lda/alias.h"
 #include "lda/array.h"
+#include "lda/corpus.h"
+#include "lda/ftree.h"
+#include "lda/numa.h"
+#include "lda/word_proposal.h"
+
+// topic id of a token, starts from 0.
+// Building with LDA_16BIT_TOPICS halves the memory of token topics,
+// and limits K to "kMaxTopics".
+#if defined LDA_16BIT_TOPICS
+typedef uint16_t Topic;
+const int kMaxTopics = 65535;
+#else
+typedef int Topic;
+const int kMaxTopics = 2147483647;
+#endif
+
+// docs of at most "kMaxImplicitDocLen" tokens may keep no row of
+// doc-topic counts, see "SamplerBase::DocTopicsCount"
+const int kMaxImplicitDocLen = 16;
+
+// doc-topic counts of a short doc, counted from its topics,
+// which fit in place without any allocation
+class ImplicitDocTopicsCount {
+ private:
+  InlineSparseTable<int, kMaxImplicitDocLen> impl_;
+  IntTable table_;
 
-struct Doc {
-  int index;  // index in "Model::words_"
-  int N;  // # of words
-};
+ public:
+  ImplicitDocTopicsCount() {
+    table_.InitExternal(&impl_);
+  }
 
-struct Word {
-  int v;  // word id in vocabulary, starts from 0
-  int k;  // topic id assign to this word, starts from 0
+  IntTable& Count(const Topic* topic, int N) {
+    impl_.Clear();
+    for (int n = 0; n < N; n++) {
+      ++table_[topic[n]];
+    }
+    return table_;
+  }
 };
 
+// parse one line of corpus: "[doc_id] word_id[:count] ...",
+// word ids start from 1 and are appended to "words" from 0.
+// return # of words appended.
+// It modifies "line" but keeps no state, so threads may parse lines at once.
+int ParseDoc(char* line, int line_no, int with_id,
+             char** doc_id, std::vector<int>* words);
+
 /************************************************************************/
 /* SamplerBase */
 /************************************************************************/
 class SamplerBase {
  protected:
   // corpus
-  std::vector<std::string> doc_ids_;
-  std::vector<Doc> docs_;
-  std::vector<Word> words_;
+  // "own_corpus_" loaded by "LoadCorpus",
+  // or another sampler's by "ShareCorpus"
+  const Corpus* corpus_;
+  Corpus own_corpus_;
+  // topics_[i]: topic id of token i, never shared
+  std::vector<Topic> topics_;
+  std::vector<int> doc_words_;  // buffer of "DocWords"
   int M_;  // # of docs
   int V_;  // # of vocabulary
+  // word-major view of the corpus, built by "InitializeWordTokens"
+  // word_tokens_[word_offsets_[v]...word_offsets_[v + 1]):
+  // indices in "corpus_->words" of word v
+  std::vector<TokenIndex> word_offsets_;
+  std::vector<TokenIndex> word_tokens_;
+  // token_docs_[i]: the doc which token i belongs to
+  std::vector<int> token_docs_;
 
   // model parameters
   int K_;  // # of topics
   // topics_count_[k]: # of words assigned to topic k
-  IntDenseTable topics_count_;
-  // docs_topics_count_[m][k]: # of words in doc m assigned to topic k
+  TokenDenseTable topics_count_;
+  // docs_topics_count_[DocRow(m)][k]: # of words in doc m assigned to topic k
   IntTables docs_topics_count_;
+  // doc_rows_[m]: row of doc m in "docs_topics_count_",
+  // -1 if doc m has at most "implicit_doc_len_" tokens and keeps no row,
+  // empty if all docs keep rows
+  std::vector<int> doc_rows_;
   // words_topics_count_[v][k]: # of word v assigned to topic k
   IntTables words_topics_count_;
 
@@ -78,9 +132,36 @@ class SamplerBase {
   int log_likelihood_interval_;
   int iteration_;
   int storage_type_;  // a value of enum TableType
+  int huge_pages_;  // back sparse tables with huge pages
+  int compact_interval_;  // interval of compacting sparse tables
+  int sort_tokens_;  // sort tokens of each doc by word id when loading
+  int compress_words_;  // keep word ids in "Corpus::compressed_words"
+  int memory_limit_;  // in MB, 0 is unlimited, see "PlanMemory"
+  int implicit_doc_len_;  // see "doc_rows_", 0 disables it
+  // keep per-token work independent of K for 100k or more topics,
+  // see "FPlusLDASampler"
+  int large_k_;
+
+  // vocabulary remapping when loading, see "RemapWords"
+  int remap_words_;
+  int min_word_count_;  // words occurring fewer times are pruned
+  double max_doc_freq_;  // words in more proportion of docs are pruned
+  std::vector<int> stop_words_;  // word ids to prune, starts from 1
+  // word_map_[v]: original id of word v, starts from 0,
+  // empty if words are not remapped
+  std::vector<int> word_map_;
+  int original_V_;  // # of vocabulary before remapping
+
+  // topic compaction between iterations, see "CompactTopics"
+  int compact_topics_interval_;  // 0 disables it
+  int min_topic_count_;  // topics of at most so many tokens are dropped
+  // topic_map_[k]: original id of topic k,
+  // empty if topics are not compacted
+  std::vector<int> topic_map_;
 
  public:
-  SamplerBase() : K_(0),
+  SamplerBase() : corpus_(&own_corpus_),
+    K_(0),
     hp_sum_alpha_(0.0),
     hp_beta_(0.0),
     hp_opt_(0),
@@ -92,7 +173,20 @@ class SamplerBase {
     total_iteration_(0),
     burnin_iteration_(0),
     log_likelihood_interval_(0),
-    storage_type_(kSparseHist) {}
+    storage_type_(kSparseHist),
+    huge_pages_(0),
+    compact_interval_(0),
+    sort_tokens_(0),
+    compress_words_(0),
+    memory_limit_(0),
+    implicit_doc_len_(0),
+    large_k_(0),
+    remap_words_(0),
+    min_word_count_(0),
+    max_doc_freq_(1.0),
+    original_V_(0),
+    compact_topics_interval_(0),
+    min_topic_count_(0) {}
   virtual ~SamplerBase();
 
   // setters
@@ -147,18 +241,145 @@ class SamplerBase {
   int& storage_type() {
     return storage_type_;
   }
+
+  int& huge_pages() {
+    return huge_pages_;
+  }
+
+  int& compact_interval() {
+    return compact_interval_;
+  }
+
+  int& compact_topics_interval() {
+    return compact_topics_interval_;
+  }
+
+  int& min_topic_count() {
+    return min_topic_count_;
+  }
+
+  int& sort_tokens() {
+    return sort_tokens_;
+  }
+
+  int& compress_words() {
+    return compress_words_;
+  }
+
+  int& memory_limit() {
+    return memory_limit_;
+  }
+
+  int& implicit_doc_len() {
+    return implicit_doc_len_;
+  }
+
+  int& large_k() {
+    return large_k_;
+  }
+
+  int& remap_words() {
+    return remap_words_;
+  }
+
+  int& min_word_count() {
+    return min_word_count_;
+  }
+
+  double& max_doc_freq() {
+    return max_doc_freq_;
+  }
+
+  std::vector<int>& stop_words() {
+    return stop_words_;
+  }
   // end of setters
 
+  // # of tokens of the corpus
+  size_t tokens() const {
+    return topics_.size();
+  }
+
+  // read the corpus in large blocks,
+  // lines of a block are split into ranges parsed by all threads
   void LoadCorpus(FILE* fp, int with_id);
+  // prune words by counts, document frequencies and the stop list,
+  // then renumber the rest densely in descending order of counts,
+  // so that rows of frequent words are contiguous
+  void RemapWords();
+  // make this sampler read the corpus loaded by "source",
+  // which must outlive it, instead of loading one by "LoadCorpus".
+  // Its topics and count tables stay private.
+  void ShareCorpus(const SamplerBase& source);
+  // sort and compress word ids of each doc, then free their array,
+  // so that they take 1-2 bytes a token mostly
+  void CompressWords();
+  // word ids of doc m,
+  // decoded to "buffer" if compressed, which is unused otherwise
+  const int* DocWords(int m, std::vector<int>* buffer) const {
+    return ::DocWords(corpus_->docs, corpus_->words,
+                      corpus_->compressed_words, m, buffer);
+  }
+  int DocRow(int m) const {
+    return doc_rows_.empty() ? m : doc_rows_[m];
+  }
+  // doc-topic counts of doc m, its row of "docs_topics_count_",
+  // or counted from its topics to "implicit" if it keeps no row,
+  // which lasts while the caller changes both in step
+  IntTable& DocTopicsCount(int m, ImplicitDocTopicsCount* implicit) {
+    const int row = DocRow(m);
+    if (row >= 0) {
+      return docs_topics_count_[row];
+    }
+    const Doc& doc = corpus_->docs[m];
+    return implicit->Count(&topics_[doc.index], doc.N);
+  }
+  const IntTable& DocTopicsCount(int m,
+                                 ImplicitDocTopicsCount* implicit) const {
+    const int row = DocRow(m);
+    if (row >= 0) {
+      return docs_topics_count_[row];
+    }
+    const Doc& doc = corpus_->docs[m];
+    return implicit->Count(&topics_[doc.index], doc.N);
+  }
+  // theta and phi are collected and saved row by row,
+  // taking no memory of M * K or K * V
   void SaveModel(const std::string& prefix) const;
+  // estimate peak memory of training from the corpus and options,
+  // expecting rows of count tables to be as dense as after
+  // random initialization, when they are the densest mostly.
+  // Over "memory_limit_", it switches to the smallest storage type,
+  // then caps caches of the sampler, and fails if neither fits.
+  int PlanMemory();
+  // estimated peak bytes of structures of a sampler,
+  // "word_nnz" is the expected # of nonzero counts of all words
+  virtual double SamplerBytes(double word_nnz) const;
+  // cap caches of a sampler to fit in "bytes",
+  // return 0 if it has any caches
+  virtual int LimitSamplerBytes(double bytes, double word_nnz);
+  // # of threads updating rows of "docs_topics_count_" concurrently
+  virtual int DocRowThreads() const;
   int Initialize();
+  // count topics of all tokens into new tables of "K_" topics
+  void CountTopics();
+  // drop topics of at most "min_topic_count_" tokens,
+  // moving their tokens to random surviving topics,
+  // and renumber the others densely in all counts, "topics_" and "hp_alpha_".
+  // return 1 if any is dropped, then "InitializeSampler" must run again
+  int CompactTopics();
+  // build the view once, words never change
+  void InitializeWordTokens();
+  // bytes of the view built by "InitializeWordTokens"
+  double WordTokensBytes() const;
   virtual int InitializeSampler();
-  virtual void CollectTheta(Array2D<double>* theta) const;
-  virtual void CollectPhi(Array2D<double>* phi) const;
+  virtual void CollectTheta(int m, double* theta_m) const;
+  virtual void CollectPhi(int k, double* phi_k) const;
   virtual double LogLikelihood() const;
   virtual int Train();
   virtual void PreSampleCorpus();
   virtual void PostSampleCorpus();
+  void CompactTables();
   virtual void SampleCorpus();
   virtual void PreSampleDocument(int m);
   virtual void PostSampleDocument(int m);
@@ -198,26 +419,37 @@ class GibbsSampler : public SamplerBase {
 /************************************************************************/
 class SparseLDASampler : public SamplerBase {
  private:
-  double smooth_sum_;
+  // smooth bucket: alpha_k * beta / (N_k + sum_beta) of all topics,
+  // updated and sampled in O(log K)
+  FTree smooth_tree_;
+  // doc bucket: N_mk * beta / (N_k + sum_beta),
+  // which is 0 except doc m's topics
   double doc_sum_;
-  double word_sum_;
-  std::vector<double> smooth_pdf_;
   std::vector<double> doc_pdf_;
+  // word bucket: N_vk * cache_[k] of word v's topics, compact
+  double word_sum_;
+  std::vector<int> word_topics_;
   std::vector<double> word_pdf_;
+  // word_positions_[k]: index of topic k in "word_topics_", -1 if absent,
+  // only kept for a word which is followed by a run of itself
+  std::vector<int> word_positions_;
+  int word_positioned_;
   std::vector<double> cache_;
 
  public:
-  SparseLDASampler() {}
+  SparseLDASampler() : word_positioned_(0) {}
 
   virtual int InitializeSampler();
   virtual void PostSampleCorpus();
   virtual void PostSampleDocument(int m);
   virtual void SampleDocument(int m);
-  void RemoveOrAddWordTopic(int m, int v, int k, int remove);
-  int SampleDocumentWord(int m, int v);
+  void RemoveOrAddWordTopic(IntTable* doc_m_topics_count,
+                            int v, int k, int remove);
+  int SampleDocumentWord(const IntTable& doc_m_topics_count, int v);
   void PrepareSmoothBucket();
-  void PrepareDocBucket(int m);
-  void PrepareWordBucket(int v);
+  void PrepareDocBucket(const IntTable& doc_m_topics_count);
+  void PrepareWordBucket(int v, int positioned);
+  void UpdateWordBucket(int v, int k);
 };
 
 /************************************************************************/
@@ -226,10 +458,8 @@ class SparseLDASampler : public SamplerBase {
 class AliasLDASampler : public SamplerBase {
  private:
   std::vector<double> p_pdf_;
-  std::vector<double> q_sums_;  // for each word v
-  std::vector<std::vector<int> > q_samples_;  // for each word v
-  std::vector<double> q_pdf_;
-  Alias q_alias_table_;
+  // q: alpha_k * (N_vk + beta)/(N_k + sum_beta)
+  WordProposal q_proposal_;
 
   int mh_step_;
 
@@ -240,9 +470,21 @@ class AliasLDASampler : public SamplerBase {
   int& mh_step() {
     return mh_step_;
   }
+
+  int& builders() {
+    return q_proposal_.builders();
+  }
+
+  int& proposal_memory() {
+    return q_proposal_.memory_limit();
+  }
   // end of setters
 
+  virtual double SamplerBytes(double word_nnz) const;
+  virtual int LimitSamplerBytes(double bytes, double word_nnz);
   virtual int InitializeSampler();
+  virtual void SampleCorpus();
+  virtual void PreSampleDocument(int m);
   virtual void SampleDocument(int m);
 };
 
@@ -252,9 +494,8 @@ class AliasLDASampler : public SamplerBase {
 class LightLDASampler : public SamplerBase {
  private:
   Alias hp_alpha_alias_table_;
-  Alias word_alias_table_;
-  std::vector<double> word_topics_pdf_;
-  std::vector<std::vector<int> > words_topic_samples_;
+  // word-proposal: (N_vk + beta)/(N_k + sum_beta)
+  WordProposal word_proposal_;
   int mh_step_;
   int enable_word_proposal_;
   int enable_doc_proposal_;
@@ -276,13 +517,218 @@ class LightLDASampler : public SamplerBase {
   int& enable_doc_proposal() {
     return enable_doc_proposal_;
   }
+
+  int& builders() {
+    return word_proposal_.builders();
+  }
+
+  int& proposal_memory() {
+    return word_proposal_.memory_limit();
+  }
   // end of setters
 
+  virtual double SamplerBytes(double word_nnz) const;
+  virtual int LimitSamplerBytes(double bytes, double word_nnz);
   virtual int InitializeSampler();
   virtual void PostSampleCorpus();
+  virtual void SampleCorpus();
+  virtual void PreSampleDocument(int m);
   virtual void SampleDocument(int m);
-  int SampleWithWord(int v);
+  int SampleWithWord(int v) {
+    word_proposal_.Prepare(v, 1);
+    return word_proposal_.Sample(v);
+  }
   int SampleWithDoc(const Doc& doc, int v);
 };
 
+/************************************************************************/
+/* FPlusLDASampler */
+/************************************************************************/
+class FPlusLDASampler : public SamplerBase {
+ private:
+  // F+ tree over alpha_k * (N_vk + beta) / (N_k + sum_beta)
+  // of the word being sampled, built in O(K) for each word.
+  // In large K mode, it is split into
+  //   alpha_k * N_vk / (N_k + sum_beta)  [word_tree_ over "word_slots_"]
+  // + alpha_k * beta / (N_k + sum_beta)  [smooth_tree_ over all topics]
+  // where the former is built in O(N_v) for each word,
+  // and the latter is kept and updated in O(log K) for each token.
+  FTree word_tree_;
+  std::vector<double> word_pdf_;
+  FTree smooth_tree_;
+  // word_slots_[i]: topic of leaf i of "word_tree_",
+  // nonzero topics of the word being sampled and new topics of its tokens
+  std::vector<int> word_slots_;
+  // word_positions_[k]: leaf of topic k in "word_tree_", -1 if none
+  std::vector<int> word_positions_;
+  // word_topics_count_[k]: dense copy of N_vk of the word being sampled
+  std::vector<int> word_topics_count_;
+  // N_mk * (N_vk + beta) / (N_k + sum_beta) over doc m's nonzero topics
+  std::vector<int> doc_topics_;
+  std::vector<double> doc_cdf_;
+
+ public:
+  FPlusLDASampler() {}
+
+  virtual double SamplerBytes(double word_nnz) const;
+  virtual int InitializeSampler();
+  virtual void PostSampleCorpus();
+  virtual void SampleCorpus();
+  virtual void SampleDocument(int m);
+  void LoadWord(int v);
+  void UnloadWord(int v);
+  // sample token "index" of doc m, which is word v
+  void SampleWordToken(int m, int v, TokenIndex index);
+  // update trees after counts of topic k have changed
+  void UpdateTopic(int k);
+  void BuildSmoothTree();
+
+  double WordPdf(int k) const {
+    return hp_alpha_[k] * (word_topics_count_[k] + hp_beta_)
+           / (topics_count_[k] + hp_sum_beta_);
+  }
+
+  double SparseWordPdf(int k) const {
+    return hp_alpha_[k] * word_topics_count_[k]
+           / (topics_count_[k] + hp_sum_beta_);
+  }
+
+  double SmoothPdf(int k) const {
+    return hp_alpha_[k] * hp_beta_ / (topics_count_[k] + hp_sum_beta_);
+  }
+};
+
+/************************************************************************/
+/* WarpLDASampler */
+/************************************************************************/
+class WarpLDASampler : public SamplerBase {
+ private:
+  Alias hp_alpha_alias_table_;
+  // proposals_[i * mh_step_ + j]: the j-th proposal of token i,
+  // doc proposals after a doc phase, word proposals after a word phase.
+  std::vector<Topic> proposals_;
+  // synced_topics_[i]: topic of token i counted in the count tables
+  std::vector<Topic> synced_topics_;
+  // local_topics_count_[k]: N_mk or N_vk of the doc or word being sampled
+  std::vector<int> local_topics_count_;
+  // word_topics_[i] and word_proposals_[i * mh_step_ + j]:
+  // topic and proposals of token word_tokens_[i], gathered before
+  // a word phase to be scanned in order, and scattered back after it
+  std::vector<Topic> word_topics_;
+  std::vector<Topic> word_proposals_;
+  // new topics of tokens of the word being sampled
+  std::vector<Topic> new_topics_;
+  int mh_step_;
+
+ public:
+  WarpLDASampler() : mh_step_(0) {}
+
+  // setters
+  int& mh_step() {
+    return mh_step_;
+  }
+  // end of setters
+
+  virtual double SamplerBytes(double word_nnz) const;
+  virtual int InitializeSampler();
+  virtual void PostSampleCorpus();
+  virtual void SampleCorpus();
+  virtual void SampleDocument(int m);
+  void GatherWordTokens();
+  void ScatterWordTokens();
+  void SampleWord(int v);
+  void DrawDocProposals(int m);
+  void DrawWordProposals(int v);
+  void ApplyDelayedUpdates();
+};
+
+/************************************************************************/
+/* PolyaUrnLDASampler */
+/************************************************************************/
+// Partially collapsed sampler:
+// phi is drawn once per iteration from a sparse Polya urn approximation,
+// then documents are sampled in parallel with phi fixed.
+class PolyaUrnLDASampler : public SamplerBase {
+ private:
+  // phi in CSR format,
+  // topics/values[offsets[v]...offsets[v + 1]):
+  // nonzero topics of word v and their phi_kv, sorted by topic id
+  struct PhiTable {
+    std::vector<int> offsets;
+    std::vector<int> topics;
+    std::vector<double> values;
+    // alias tables over alpha_k * phi_kv, aligned with "values"
+    std::vector<AliasItem> alias;
+    // alpha_sums[v]: sum of alpha_k * phi_kv
+    std::vector<double> alpha_sums;
+  };
+  // phis_[0]: phi drawn by "SamplePhi",
+  // phis_[i]: its copy on NUMA node i, read by threads there(numa)
+  std::vector<PhiTable> phis_;
+
+  // a word whose topic changed from "old_k" to "new_k"
+  struct TopicChange {
+    int v;
+    int old_k;
+    int new_k;
+  };
+
+  // thread local states
+  struct ThreadState {
+    RandEngine rand;
+    Alias alias;
+    std::vector<int> doc_words;  // buffer of "DocWords"
+    std::vector<int> doc_topics;
+    std::vector<double> doc_cdf;
+    std::vector<double> topics_sum;
+    std::vector<std::pair<int, double> > items;
+    std::vector<TopicChange> changes;
+    // words drawn from the prior part of phi: (word, topic)
+    std::vector<std::pair<int, int> > prior_words;
+    int node;  // NUMA node it is pinned to(numa), 0 otherwise
+    TokenIndex tokens;  // # of tokens sampled in the iteration(numa)
+    double seconds;  // time of sampling them(numa)
+  };
+  std::vector<ThreadState> thread_states_;
+  int threads_;
+  // pin threads to NUMA nodes, move their docs' tokens there,
+  // and keep a copy of phi on each node
+  int numa_;
+  Numa topology_;
+  // thread_docs_[t]...thread_docs_[t + 1]: docs always sampled by thread t,
+  // about the same # of tokens for each thread(numa)
+  std::vector<int> thread_docs_;
+
+ public:
+  PolyaUrnLDASampler() : threads_(0), numa_(0) {}
+
+  // setters
+  int& threads() {
+    return threads_;
+  }
+
+  int& numa() {
+    return numa_;
+  }
+  // end of setters
+
+  virtual double SamplerBytes(double word_nnz) const;
+  virtual int DocRowThreads() const;
+  virtual int InitializeSampler();
+  virtual void SampleCorpus();
+  virtual void SampleDocument(int m);
+  void SamplePhi();
+  void SampleDocument(int m, ThreadState* state);
+  void ApplyChanges();
+  // pin threads, split docs among them and move their tokens
+  void InitializeNuma();
+  // copy phis_[0] to the other nodes, each by a thread of the node,
+  // whose first touch places the pages there
+  void ReplicatePhi();
+  // log tokens/sec and bandwidth of words and topics of each node
+  void LogNodes() const;
+
+  static double Phi(const PhiTable& table, int v, int k);
+};
+
 #endif  // SRC_LDA_SAMPLER_H_
@@ -0,0 +1,246 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <algorithm>
+#include "common/line-reader.h"
+#include "common/x.h"
+#include "lda/rand.h"
+#include "lda/scvb0.h"
+
+void SCVB0::Train(FILE* fp, int with_id, const std::string& prefix) {
+  LineReader line_reader;
+  int line_no = 0;
+  char* doc_id = NULL;
+  Doc doc;
+
+  const std::string filename = prefix + "-doc-topic";
+  ScopedFile doc_topic_fp(filename.c_str(), ScopedFile::Write);
+
+  Log("Training online.\n");
+  while (line_reader.ReadLine(fp) != NULL) {
+    line_no++;
+
+    doc.index = (TokenIndex)words_.size();
+    doc.N = ParseDoc(line_reader.buf, line_no, with_id, &doc_id, &words_);
+    if (doc.N == 0) {
+      continue;
+    }
+    if (with_id) {
+      doc_ids_.push_back(doc_id);
+    }
+    docs_.push_back(doc);
+
+    if ((int)docs_.size() == batch_size_) {
+      TrainBatch(doc_topic_fp);
+      if (save_interval_ && batch_count_ % save_interval_ == 0) {
+        SaveModel(prefix);
+      }
+    }
+  }
+  TrainBatch(doc_topic_fp);
+  SaveModel(prefix);
+}
+
+void SCVB0::SaveModel(const std::string& prefix) const {
+  std::string filename;
+  Log("Saving model.\n");
+  {
+    filename = prefix + "-stat";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    fprintf(fp, "M=%d\n", M_);
+    fprintf(fp, "V=%d\n", V_);
+    fprintf(fp, "K=%d\n", K_);
+  }
+  {
+    // phi_k[k][v]: the probability that word v is assigned to topic k
+    const double hp_sum_beta = V_ * hp_beta_;
+    filename = prefix + "-topic-word";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (int k = 0; k < K_; k++) {
+      const double denom = topics_stat_[k] + hp_sum_beta;
+      for (int v = 0; v < V_; v++) {
+        const double phi_kv =
+          (words_topics_stat_[(size_t)v * K_ + k] * scale_ + hp_beta_)
+          / denom;
+        fprintf(fp, (v == V_ - 1) ? "%lg\n" : "%lg ", phi_kv);
+      }
+    }
+  }
+  {
+    filename = prefix + "-alpha";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    for (int k = 0; k < K_; k++) {
+      fprintf(fp, "%lg\n", hp_alpha_[k]);
+    }
+  }
+  {
+    filename = prefix + "-beta";
+    ScopedFile fp(filename.c_str(), ScopedFile::Write);
+    fprintf(fp, "%lg\n", hp_beta_);
+  }
+  Log("Done.\n");
+}
+
+void SCVB0::Initialize() {
+  if (hp_sum_alpha_ <= 0.0) {
+    // smart prior according to the first mini-batch
+    double avg_doc_len = (double)words_.size() / docs_.size();
+    hp_alpha_.resize(K_, avg_doc_len / K_);
+    hp_sum_alpha_ = avg_doc_len;
+  } else {
+    hp_alpha_.resize(K_, hp_sum_alpha_);
+    hp_sum_alpha_ = hp_sum_alpha_ * K_;
+  }
+
+  if (hp_beta_ <= 0.0) {
+    hp_beta_ = 0.1;
+  }
+
+  topics_stat_.resize(K_);
+  doc_topics_stat_.resize(K_);
+  gamma_.resize(K_);
+}
+
+void SCVB0::TrainBatch(FILE* doc_topic_fp) {
+  if (docs_.empty()) {
+    return;
+  }
+
+  if (batch_count_ == 0) {
+    Initialize();
+  }
+  batch_count_++;
+
+  // grow vocabulary
+  const int batch_tokens = (int)words_.size();
+  int old_V = V_;
+  int i, m, k;
+  for (i = 0; i < batch_tokens; i++) {
+    if (words_[i] >= V_) {
+      V_ = words_[i] + 1;
+    }
+  }
+  if (V_ != old_V) {
+    words_topics_stat_.resize((size_t)V_ * K_, 0.0f);
+    words_slot_.resize(V_, -1);
+  }
+
+  batch_words_.clear();
+  for (i = 0; i < batch_tokens; i++) {
+    const int v = words_[i];
+    if (words_slot_[v] < 0) {
+      words_slot_[v] = (int)batch_words_.size();
+      batch_words_.push_back(v);
+    }
+  }
+  const int batch_V = (int)batch_words_.size();
+  batch_words_topics_stat_.assign((size_t)batch_V * K_, 0.0);
+
+  for (m = 0; m < (int)docs_.size(); m++) {
+    const Doc& doc = docs_[m];
+    InferDocument(m);
+
+    if (!doc_ids_.empty()) {
+      fprintf(doc_topic_fp, "%s ", doc_ids_[m].c_str());
+    }
+    for (k = 0; k < K_; k++) {
+      const double theta_mk = (doc_topics_stat_[k] + hp_alpha_[k])
+                              / (doc.N + hp_sum_alpha_);
+      fprintf(doc_topic_fp, (k == K_ - 1) ? "%lg\n" : "%lg ", theta_mk);
+    }
+  }
+
+  M_ += (int)docs_.size();
+  tokens_seen_ += batch_tokens;
+  const double C = (corpus_tokens_ > 0.0) ? corpus_tokens_ : tokens_seen_;
+  double rho = step_scale_ / pow(step_tau_ + batch_count_, step_kappa_);
+  if (rho >= 1.0) {
+    rho = 1.0;
+    std::fill(words_topics_stat_.begin(), words_topics_stat_.end(), 0.0f);
+    scale_ = 1.0;
+  } else {
+    scale_ *= 1.0 - rho;
+  }
+
+  // N_phi = (1 - rho) * N_phi + rho * C / |batch| * N_phi_batch
+  const double weight = rho * C / batch_tokens;
+  for (k = 0; k < K_; k++) {
+    topics_stat_[k] *= 1.0 - rho;
+  }
+  for (i = 0; i < batch_V; i++) {
+    float* word_topics_stat = &words_topics_stat_[(size_t)batch_words_[i] * K_];
+    const double* batch_word_topics_stat = &batch_words_topics_stat_[i * K_];
+    for (k = 0; k < K_; k++) {
+      word_topics_stat[k] +=
+        (float)(weight * batch_word_topics_stat[k] / scale_);
+      topics_stat_[k] += weight * batch_word_topics_stat[k];
+    }
+    words_slot_[batch_words_[i]] = -1;
+  }
+
+  if (scale_ < 1e-6) {
+    FoldScale();
+  }
+
+  Log("Mini-batch %d done, %d documents seen.\n", batch_count_, M_);
+  doc_ids_.clear();
+  docs_.clear();
+  words_.clear();
+}
+
+void SCVB0::InferDocument(int m) {
+  const Doc& doc = docs_[m];
+  const double hp_sum_beta = V_ * hp_beta_;
+  int k;
+
+  // random initialization breaks the symmetry among topics
+  double sum = 0.0;
+  for (k = 0; k < K_; k++) {
+    doc_topics_stat_[k] = Rand::Double01() + 1e-3;
+    sum += doc_topics_stat_[k];
+  }
+  for (k = 0; k < K_; k++) {
+    doc_topics_stat_[k] *= doc.N / sum;
+  }
+
+  int t = 0;
+  for (int pass = 0; pass <= doc_burnin_; pass++) {
+    const int last_pass = (pass == doc_burnin_);
+    const int* word = &words_[doc.index];
+    for (int n = 0; n < doc.N; n++, word++) {
+      const float* word_topics_stat = &words_topics_stat_[(size_t)*word * K_];
+      sum = 0.0;
+      for (k = 0; k < K_; k++) {
+        gamma_[k] = (word_topics_stat[k] * scale_ + hp_beta_)
+                    / (topics_stat_[k] + hp_sum_beta)
+                    * (doc_topics_stat_[k] + hp_alpha_[k]);
+        sum += gamma_[k];
+      }
+
+      // N_theta = (1 - rho) * N_theta + rho * N_m * gamma
+      const double rho = 1.0 / pow(10.0 + t, 0.9);
+      t++;
+      for (k = 0; k < K_; k++) {
+        gamma_[k] /= sum;
+        doc_topics_stat_[k] = (1.0 - rho) * doc_topics_stat_[k]
+                              + rho * doc.N * gamma_[k];
+      }
+
+      if (last_pass) {
+        double* batch_word_topics_stat =
+          &batch_words_topics_stat_[words_slot_[*word] * K_];
+        for (k = 0; k < K_; k++) {
+          batch_word_topics_stat[k] += gamma_[k];
+        }
+      }
+    }
+  }
+}
+
+void SCVB0::FoldScale() {
+  for (size_t i = 0; i < words_topics_stat_.size(); i++) {
+    words_topics_stat_[i] = (float)(words_topics_stat_[i] * scale_);
+  }
+  scale_ = 1.0;
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// online lda with stochastic collapsed variational bayes(SCVB0)
+//
+
+#ifndef SRC_LDA_SCVB0_H_
+#define SRC_LDA_SCVB0_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "lda/sampler.h"
+
+// SCVB0 consumes documents from a stream in mini-batches,
+// only expected word-topic and topic counts stay in memory.
+// Theta of each document is written once its mini-batch is done.
+class SCVB0 {
+ private:
+  // mini-batch
+  std::vector<std::string> doc_ids_;
+  std::vector<Doc> docs_;
+  std::vector<int> words_;
+  // batch_words_[i]: i-th distinct word in the mini-batch
+  std::vector<int> batch_words_;
+  // words_slot_[v]: index of word v in "batch_words_", -1 if absent
+  std::vector<int> words_slot_;
+  // batch_words_topics_stat_[i * K_ + k]:
+  // expected # of word "batch_words_[i]" assigned to topic k in the batch
+  std::vector<double> batch_words_topics_stat_;
+  std::vector<double> doc_topics_stat_;
+  std::vector<double> gamma_;
+
+  // model
+  int M_;  // # of docs seen
+  int V_;  // # of vocabulary seen
+  int K_;  // # of topics
+  // words_topics_stat_[v * K_ + k] * scale_:
+  // expected # of word v assigned to topic k.
+  // "scale_" makes decaying all words O(1).
+  std::vector<float> words_topics_stat_;
+  double scale_;
+  // topics_stat_[k]: expected # of words assigned to topic k
+  std::vector<double> topics_stat_;
+  double tokens_seen_;
+  int batch_count_;
+
+  // model hyper parameters
+  std::vector<double> hp_alpha_;
+  double hp_sum_alpha_;
+  double hp_beta_;
+
+  // online options
+  int batch_size_;
+  int doc_burnin_;
+  // step size of topics is step_scale_ / (step_tau_ + t) ^ step_kappa_,
+  // where t is # of mini-batches
+  double step_scale_;
+  double step_tau_;
+  double step_kappa_;
+  // total # of words of the stream, 0 uses # of words seen so far
+  double corpus_tokens_;
+  // save a snapshot every "save_interval_" mini-batches, 0 disables it
+  int save_interval_;
+
+ public:
+  SCVB0() : M_(0), V_(0), K_(0),
+    scale_(1.0),
+    tokens_seen_(0.0),
+    batch_count_(0),
+    hp_sum_alpha_(0.0),
+    hp_beta_(0.0),
+    batch_size_(256),
+    doc_burnin_(2),
+    step_scale_(100.0),
+    step_tau_(1000.0),
+    step_kappa_(0.9),
+    corpus_tokens_(0.0),
+    save_interval_(0) {}
+
+  // setters
+  int& K() {
+    return K_;
+  }
+
+  double& alpha() {
+    return hp_sum_alpha_;
+  }
+
+  double& beta() {
+    return hp_beta_;
+  }
+
+  int& batch_size() {
+    return batch_size_;
+  }
+
+  int& doc_burnin() {
+    return doc_burnin_;
+  }
+
+  double& step_scale() {
+    return step_scale_;
+  }
+
+  double& step_tau() {
+    return step_tau_;
+  }
+
+  double& step_kappa() {
+    return step_kappa_;
+  }
+
+  double& corpus_tokens() {
+    return corpus_tokens_;
+  }
+
+  int& save_interval() {
+    return save_interval_;
+  }
+  // end of setters
+
+  // read "fp" to the end, write "prefix"-doc-topic along the way,
+  // and the rest of the model at the end, see "SamplerBase::SaveModel"
+  void Train(FILE* fp, int with_id, const std::string& prefix);
+  void SaveModel(const std::string& prefix) const;
+
+ private:
+  void Initialize();
+  void TrainBatch(FILE* doc_topic_fp);
+  // infer theta of doc m, accumulate its words into the mini-batch
+  void InferDocument(int m);
+  void FoldScale();
+};
+
+#endif  // SRC_LDA_SCVB0_H_
@@ -6,9 +6,11 @@
 #include "lda/sampler.h"
 
 int SparseLDASampler::InitializeSampler() {
-  smooth_pdf_.resize(K_);
-  doc_pdf_.resize(K_);
-  word_pdf_.resize(K_);
+  doc_pdf_.assign(K_, 0.0);
+  word_topics_.clear();
+  word_pdf_.clear();
+  word_positions_.assign(K_, -1);
+  word_positioned_ = 0;
   cache_.resize(K_);
   PrepareSmoothBucket();
   return 0;
@@ -23,7 +25,8 @@ void SparseLDASampler::PostSampleCorpus() {
 }
 
 void SparseLDASampler::PostSampleDocument(int m) {
-  const IntTable& doc_m_topics_count = docs_topics_count_[m];
+  ImplicitDocTopicsCount implicit;
+  const IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
   IntTable::const_iterator first = doc_m_topics_count.begin();
   IntTable::const_iterator last = doc_m_topics_count.end();
   for (; first != last; ++first) {
@@ -35,72 +38,89 @@ void SparseLDASampler::PostSampleDocument(int m) {
 }
 
 void SparseLDASampler::SampleDocument(int m) {
-  PrepareDocBucket(m);
-
-  const Doc& doc = docs_[m];
-  Word* word = &words_[doc.index];
-
-  for (int n = 0; n < doc.N; n++, word++) {
-    const int v = word->v;
-    const int old_k = word->k;
-    RemoveOrAddWordTopic(m, v, old_k, 1);
-    PrepareWordBucket(v);
-    const int new_k = SampleDocumentWord(m, v);
-    RemoveOrAddWordTopic(m, v, new_k, 0);
-    word->k = new_k;
+  ImplicitDocTopicsCount implicit;
+  IntTable& doc_m_topics_count = DocTopicsCount(m, &implicit);
+  PrepareDocBucket(doc_m_topics_count);
+
+  const Doc& doc = corpus_->docs[m];
+  const int* word = DocWords(m, &doc_words_);
+  Topic* topic = &topics_[doc.index];
+
+  int last_v = -1;
+  int last_k = -1;
+  for (int n = 0; n < doc.N; n++, word++, topic++) {
+    const int v = *word;
+    const int old_k = *topic;
+    RemoveOrAddWordTopic(&doc_m_topics_count, v, old_k, 1);
+    if (v == last_v) {
+      // in a run of the same word,
+      // only topics of the last token and this one have changed
+      UpdateWordBucket(v, last_k);
+      UpdateWordBucket(v, old_k);
+    } else {
+      PrepareWordBucket(v, n + 1 < doc.N && word[1] == v);
+    }
+    const int new_k = SampleDocumentWord(doc_m_topics_count, v);
+    RemoveOrAddWordTopic(&doc_m_topics_count, v, new_k, 0);
+    *topic = (Topic)new_k;
+    last_v = v;
+    last_k = new_k;
+  }
+
+  // keep doc_pdf_ all 0 between docs
+  IntTable::const_iterator first = doc_m_topics_count.begin();
+  IntTable::const_iterator last = doc_m_topics_count.end();
+  for (; first != last; ++first) {
+    doc_pdf_[first.id()] = 0.0;
   }
 }
 
-void SparseLDASampler::RemoveOrAddWordTopic(int m, int v, int k, int remove) {
-  IntTable& doc_m_topics_count = docs_topics_count_[m];
+void SparseLDASampler::RemoveOrAddWordTopic(IntTable* doc_m_topics_count,
+                                            int v, int k, int remove) {
   IntTable& word_v_topics_count = words_topics_count_[v];
-  double& smooth_bucket_k = smooth_pdf_[k];
   double& doc_bucket_k = doc_pdf_[k];
   const double hp_alpha_k = hp_alpha_[k];
   int doc_topic_count;
-  int topic_count;
+  TokenIndex topic_count;
 
-  smooth_sum_ -= smooth_bucket_k;
   doc_sum_ -= doc_bucket_k;
 
   if (remove) {
-    doc_topic_count = --doc_m_topics_count[k];
+    doc_topic_count = --(*doc_m_topics_count)[k];
     --word_v_topics_count[k];
     topic_count = --topics_count_[k];
   } else {
-    doc_topic_count = ++doc_m_topics_count[k];
+    doc_topic_count = ++(*doc_m_topics_count)[k];
     ++word_v_topics_count[k];
     topic_count = ++topics_count_[k];
   }
 
-  smooth_bucket_k = hp_alpha_k * hp_beta_ / (topic_count + hp_sum_beta_);
-  doc_bucket_k = doc_topic_count * hp_beta_ / (topic_count + hp_sum_beta_);
-  smooth_sum_ += smooth_bucket_k;
+  const double tmp = topic_count + hp_sum_beta_;
+  smooth_tree_.Update(k, hp_alpha_k * hp_beta_ / tmp);
+  doc_bucket_k = doc_topic_count * hp_beta_ / tmp;
   doc_sum_ += doc_bucket_k;
-  cache_[k] = (doc_topic_count + hp_alpha_k) / (topic_count + hp_sum_beta_);
+  cache_[k] = (doc_topic_count + hp_alpha_k) / tmp;
 }
 
-int SparseLDASampler::SampleDocumentWord(int m, int v) {
-  const double sum = smooth_sum_ + doc_sum_ + word_sum_;
+int SparseLDASampler::SampleDocumentWord(
+    const IntTable& doc_m_topics_count, int v) {
+  const double sum = smooth_tree_.sum() + doc_sum_ + word_sum_;
   double sample = Rand::Double01() * sum;
   int new_k = -1;
 
   if (sample < word_sum_) {
-    const IntTable& word_v_topics_count = words_topics_count_[v];
-    IntTable::const_iterator first = word_v_topics_count.begin();
-    IntTable::const_iterator last = word_v_topics_count.end();
-    for (; first != last; ++first) {
-      const int k = first.id();
-      sample -= word_pdf_[k];
+    const int size = (int)word_topics_.size();
+    int i;
+    for (i = 0; i < size - 1; i++) {
+      sample -= word_pdf_[i];
       if (sample <= 0.0) {
         break;
       }
     }
-    new_k = first.id();
+    new_k = word_topics_[i];
   } else {
     sample -= word_sum_;
     if (sample < doc_sum_) {
-      const IntTable& doc_m_topics_count = docs_topics_count_[m];
       IntTable::const_iterator first = doc_m_topics_count.begin();
       IntTable::const_iterator last = doc_m_topics_count.end();
       for (; first != last; ++first) {
@@ -113,14 +133,7 @@ int SparseLDASampler::SampleDocumentWord(int m, int v) {
       new_k = first.id();
     } else {
       sample -= doc_sum_;
-      int k;
-      for (k = 0; k < K_; k++) {
-        sample -= smooth_pdf_[k];
-        if (sample <= 0.0) {
-          break;
-        }
-      }
-      new_k = k;
+      new_k = smooth_tree_.Sample(sample);
     }
   }
 
@@ -128,20 +141,17 @@ int SparseLDASampler::SampleDocumentWord(int m, int v) {
 }
 
 void SparseLDASampler::PrepareSmoothBucket() {
-  smooth_sum_ = 0.0;
+  std::vector<double> smooth_pdf(K_);
   for (int k = 0; k < K_; k++) {
     const double tmp = hp_alpha_[k] / (topics_count_[k] + hp_sum_beta_);
-    const double pdf = tmp * hp_beta_;
-    smooth_pdf_[k] = pdf;
-    smooth_sum_ += pdf;
+    smooth_pdf[k] = tmp * hp_beta_;
     cache_[k] = tmp;
   }
+  smooth_tree_.Build(smooth_pdf);
 }
 
-void SparseLDASampler::PrepareDocBucket(int m) {
+void SparseLDASampler::PrepareDocBucket(const IntTable& doc_m_topics_count) {
   doc_sum_ = 0.0;
-  doc_pdf_.assign(K_, 0);
-  const IntTable& doc_m_topics_count = docs_topics_count_[m];
   IntTable::const_iterator first = doc_m_topics_count.begin();
   IntTable::const_iterator last = doc_m_topics_count.end();
   for (; first != last; ++first) {
@@ -154,16 +164,44 @@ void SparseLDASampler::PrepareDocBucket(int m) {
   }
 }
 
-void SparseLDASampler::PrepareWordBucket(int v) {
+void SparseLDASampler::PrepareWordBucket(int v, int positioned) {
+  if (word_positioned_) {
+    for (size_t i = 0; i < word_topics_.size(); i++) {
+      word_positions_[word_topics_[i]] = -1;
+    }
+  }
+  word_positioned_ = positioned;
+
   word_sum_ = 0.0;
-  word_pdf_.assign(K_, 0);
+  word_topics_.clear();
+  word_pdf_.clear();
   const IntTable& word_v_topics_count = words_topics_count_[v];
   IntTable::const_iterator first = word_v_topics_count.begin();
   IntTable::const_iterator last = word_v_topics_count.end();
   for (; first != last; ++first) {
     const int k = first.id();
     const double pdf = first.count() * cache_[k];
-    word_pdf_[k] = pdf;
+    if (positioned) {
+      word_positions_[k] = (int)word_topics_.size();
+    }
+    word_topics_.push_back(k);
+    word_pdf_.push_back(pdf);
+    word_sum_ += pdf;
+  }
+}
+
+void SparseLDASampler::UpdateWordBucket(int v, int k) {
+  const IntTable& word_v_topics_count = words_topics_count_[v];
+  const double pdf = word_v_topics_count[k] * cache_[k];
+  int& i = word_positions_[k];
+  if (i == -1) {
+    i = (int)word_topics_.size();
+    word_topics_.push_back(k);
+    word_pdf_.push_back(pdf);
     word_sum_ += pdf;
+  } else {
+    // topics whose counts drop to 0 are kept with a 0 pdf
+    word_sum_ += pdf - word_pdf_[i];
+    word_pdf_[i] = pdf;
   }
 }
@@ -0,0 +1,288 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// WarpLDA: each iteration is a word phase followed by a doc phase.
+// A phase only reads the topics of the tokens of the word or doc
+// being sampled, while global counts are frozen
+// and updated at the end of the phase.
+//
+
+#include <algorithm>
+#include "lda/rand.h"
+#include "lda/sampler.h"
+
+double WarpLDASampler::SamplerBytes(double word_nnz) const {
+  // "mh_step_" is defaulted later
+  const int mh_step = mh_step_ ? mh_step_ : 8;
+  // synced topics and proposals, and their word-major copies
+  return WordTokensBytes()
+         + (double)topics_.size() * sizeof(Topic) * (mh_step + 1) * 2
+         + K_ * (sizeof(AliasItem) + sizeof(double) + sizeof(int));
+}
+
+int WarpLDASampler::InitializeSampler() {
+  hp_alpha_alias_table_.Build(hp_alpha_, hp_sum_alpha_);
+  InitializeWordTokens();
+  if (mh_step_ == 0) {
+    mh_step_ = 8;
+  }
+  local_topics_count_.assign(K_, 0);
+
+  const TokenIndex T = (TokenIndex)topics_.size();
+  synced_topics_.resize(T);
+  for (TokenIndex i = 0; i < T; i++) {
+    synced_topics_[i] = topics_[i];
+  }
+
+  // the first word phase accepts or rejects doc proposals
+  proposals_.resize((size_t)T * mh_step_);
+  for (int m = 0; m < M_; m++) {
+    DrawDocProposals(m);
+  }
+
+  word_topics_.resize(T);
+  word_proposals_.resize((size_t)T * mh_step_);
+  TokenIndex max_N_v = 0;
+  for (int v = 0; v < V_; v++) {
+    max_N_v = std::max(max_N_v, word_offsets_[v + 1] - word_offsets_[v]);
+  }
+  new_topics_.resize(max_N_v);
+  return 0;
+}
+
+void WarpLDASampler::PostSampleCorpus() {
+  SamplerBase::PostSampleCorpus();
+
+  if (HPOpt_Enabled()) {
+    if (hp_opt_alpha_iteration_ > 0) {
+      hp_alpha_alias_table_.Build(hp_alpha_, hp_sum_alpha_);
+    }
+  }
+}
+
+void WarpLDASampler::SampleCorpus() {
+  GatherWordTokens();
+  for (int v = 0; v < V_; v++) {
+    SampleWord(v);
+  }
+  ScatterWordTokens();
+  ApplyDelayedUpdates();
+
+  for (int m = 0; m < M_; m++) {
+    PreSampleDocument(m);
+    SampleDocument(m);
+  }
+  ApplyDelayedUpdates();
+
+  for (int m = 0; m < M_; m++) {
+    PostSampleDocument(m);
+  }
+}
+
+void WarpLDASampler::SampleDocument(int m) {
+  // doc phase: accept or reject word proposals
+  const Doc& doc = corpus_->docs[m];
+  Topic* topic = &topics_[doc.index];
+  int n;
+
+  for (n = 0; n < doc.N; n++) {
+    ++local_topics_count_[topic[n]];
+  }
+
+  for (n = 0; n < doc.N; n++) {
+    const int old_k = topic[n];
+    const Topic* proposal = &proposals_[(size_t)(doc.index + n) * mh_step_];
+    int s = old_k;
+    int N_ms_prime = local_topics_count_[s] - 1;
+    TokenIndex N_s_prime = topics_count_[s] - 1;
+    double hp_alpha_s = hp_alpha_[s];
+
+    for (int step = 0; step < mh_step_; step++) {
+      const int t = proposal[step];
+      if (s == t) {
+        continue;
+      }
+
+      // calculate accept rate from topic s to topic t:
+      // (N^{'}_{mt} + \alpha_t)(N^{'}_s + \sum\beta)
+      // ---------------------------------------------
+      // (N^{'}_{ms} + \alpha_s)(N^{'}_t + \sum\beta)
+      int N_mt_prime = local_topics_count_[t];
+      TokenIndex N_t_prime = topics_count_[t];
+      if (old_k == t) {
+        N_mt_prime--;
+        N_t_prime--;
+      }
+      const double hp_alpha_t = hp_alpha_[t];
+      const double accept_rate =
+        (N_mt_prime + hp_alpha_t) / (N_ms_prime + hp_alpha_s)
+        * (N_s_prime + hp_sum_beta_) / (N_t_prime + hp_sum_beta_);
+
+      if (/*accept_rate >= 1.0 || */Rand::Double01() < accept_rate) {
+        s = t;
+        N_ms_prime = N_mt_prime;
+        N_s_prime = N_t_prime;
+        hp_alpha_s = hp_alpha_t;
+      }
+    }
+    topic[n] = (Topic)s;
+  }
+
+  for (n = 0; n < doc.N; n++) {
+    local_topics_count_[synced_topics_[doc.index + n]] = 0;
+  }
+
+  DrawDocProposals(m);
+}
+
+void WarpLDASampler::GatherWordTokens() {
+  // the only pass over tokens in random order before a word phase
+  const TokenIndex T = (TokenIndex)topics_.size();
+  for (TokenIndex i = 0; i < T; i++) {
+    const TokenIndex index = word_tokens_[i];
+    const Topic* proposal = &proposals_[(size_t)index * mh_step_];
+    word_topics_[i] = topics_[index];
+    std::copy(proposal, proposal + mh_step_,
+              &word_proposals_[(size_t)i * mh_step_]);
+  }
+}
+
+void WarpLDASampler::ScatterWordTokens() {
+  // the only pass over tokens in random order after a word phase
+  const TokenIndex T = (TokenIndex)topics_.size();
+  for (TokenIndex i = 0; i < T; i++) {
+    const TokenIndex index = word_tokens_[i];
+    const Topic* proposal = &word_proposals_[(size_t)i * mh_step_];
+    topics_[index] = word_topics_[i];
+    std::copy(proposal, proposal + mh_step_,
+              &proposals_[(size_t)index * mh_step_]);
+  }
+}
+
+void WarpLDASampler::SampleWord(int v) {
+  // word phase: accept or reject doc proposals
+  const TokenIndex begin = word_offsets_[v];
+  const TokenIndex N_v = word_offsets_[v + 1] - begin;
+  const Topic* topic = &word_topics_[begin];
+  const Topic* proposal = &word_proposals_[(size_t)begin * mh_step_];
+  TokenIndex i;
+
+  for (i = 0; i < N_v; i++) {
+    ++local_topics_count_[topic[i]];
+  }
+
+  for (i = 0; i < N_v; i++, proposal += mh_step_) {
+    const int old_k = topic[i];
+    int s = old_k;
+    int N_vs_prime = local_topics_count_[s] - 1;
+    TokenIndex N_s_prime = topics_count_[s] - 1;
+
+    for (int step = 0; step < mh_step_; step++) {
+      const int t = proposal[step];
+      if (s == t) {
+        continue;
+      }
+
+      // calculate accept rate from topic s to topic t:
+      // (N^{'}_{vt} + \beta)(N^{'}_s + \sum\beta)
+      // -----------------------------------------
+      // (N^{'}_{vs} + \beta)(N^{'}_t + \sum\beta)
+      int N_vt_prime = local_topics_count_[t];
+      TokenIndex N_t_prime = topics_count_[t];
+      if (old_k == t) {
+        N_vt_prime--;
+        N_t_prime--;
+      }
+      const double accept_rate =
+        (N_vt_prime + hp_beta_) / (N_vs_prime + hp_beta_)
+        * (N_s_prime + hp_sum_beta_) / (N_t_prime + hp_sum_beta_);
+
+      if (/*accept_rate >= 1.0 || */Rand::Double01() < accept_rate) {
+        s = t;
+        N_vs_prime = N_vt_prime;
+        N_s_prime = N_t_prime;
+      }
+    }
+    new_topics_[i] = (Topic)s;
+  }
+
+  // old topics are the synced ones
+  for (i = 0; i < N_v; i++) {
+    local_topics_count_[topic[i]] = 0;
+  }
+  std::copy(new_topics_.begin(), new_topics_.begin() + N_v,
+            word_topics_.begin() + begin);
+
+  DrawWordProposals(v);
+}
+
+void WarpLDASampler::DrawDocProposals(int m) {
+  // doc-proposal: N_mk + alpha_k
+  const Doc& doc = corpus_->docs[m];
+  Topic* proposal = &proposals_[(size_t)doc.index * mh_step_];
+  const int size = doc.N * mh_step_;
+  for (int i = 0; i < size; i++) {
+    const double sample = Rand::Double01() * (hp_sum_alpha_ + doc.N);
+    if (sample < hp_sum_alpha_) {
+      proposal[i] =
+        (Topic)hp_alpha_alias_table_.Sample(sample / hp_sum_alpha_);
+    } else {
+      int offset = (int)(sample - hp_sum_alpha_);
+      if (offset == doc.N) {
+        // rare numerical errors may lie in this branch
+        offset--;
+      }
+      proposal[i] = topics_[doc.index + offset];
+    }
+  }
+}
+
+void WarpLDASampler::DrawWordProposals(int v) {
+  // word-proposal: N_vk + beta
+  const TokenIndex begin = word_offsets_[v];
+  const TokenIndex end = word_offsets_[v + 1];
+  const TokenIndex N_v = end - begin;
+  const double sum_beta = K_ * hp_beta_;
+  const Topic* topic = &word_topics_[begin];
+  Topic* proposal = &word_proposals_[(size_t)begin * mh_step_];
+  for (TokenIndex i = begin; i < end; i++, proposal += mh_step_) {
+    for (int step = 0; step < mh_step_; step++) {
+      const double sample = Rand::Double01() * (N_v + sum_beta);
+      if (sample < N_v) {
+        proposal[step] = topic[(TokenIndex)sample];
+      } else {
+        proposal[step] = (Topic)Rand::UInt(K_);
+      }
+    }
+  }
+}
+
+void WarpLDASampler::ApplyDelayedUpdates() {
+  for (int m = 0; m < M_; m++) {
+    const Doc& doc = corpus_->docs[m];
+    const int* word = DocWords(m, &doc_words_);
+    const Topic* topic = &topics_[doc.index];
+    Topic* synced_topic = &synced_topics_[doc.index];
+    // docs without rows count their topics when needed
+    const int row = DocRow(m);
+    for (int n = 0; n < doc.N; n++, word++, topic++, synced_topic++) {
+      const int old_k = *synced_topic;
+      const int new_k = *topic;
+      if (old_k == new_k) {
+        continue;
+      }
+
+      IntTable& word_v_topics_count = words_topics_count_[*word];
+      --topics_count_[old_k];
+      --word_v_topics_count[old_k];
+      ++topics_count_[new_k];
+      ++word_v_topics_count[new_k];
+      if (row >= 0) {
+        IntTable& doc_m_topics_count = docs_topics_count_[row];
+        --doc_m_topics_count[old_k];
+        ++doc_m_topics_count[new_k];
+      }
+      *synced_topic = (Topic)new_k;
+    }
+  }
+}
@@ -0,0 +1,331 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include <algorithm>
+#include "common/parallel.h"
+#include "common/x.h"
+#include "lda/sampler.h"
+#include "lda/word_proposal.h"
+
+namespace {
+
+// builders claim docs in chunks of about "kChunk" tokens,
+// and never go further than "kLookahead" tokens ahead of the sampler.
+const int kChunk = 256;
+const int kLookahead = 65536;
+
+const double kItemSize = sizeof(AliasItem) + sizeof(int);
+
+}  // namespace
+
+double WordProposal::EstimateBytes(int V, int K, double nnz) const {
+  double items = nnz * kItemSize * (builders_ > 0 ? 2 : 1);
+  if (memory_limit_ > 0) {
+    items = std::min(items, memory_limit_ * 1048576.0);
+  }
+  return FixedBytes(V, K, nnz, memory_limit_ > 0) + items;
+}
+
+int WordProposal::LimitBytes(int V, int K, double nnz, double bytes) {
+  const double memory_limit = (bytes - FixedBytes(V, K, nnz, 1)) / 1048576.0;
+  if (memory_limit < 1.0) {
+    return -1;
+  }
+  memory_limit_ = (int)std::min(memory_limit, 2147483647.0);
+  return 0;
+}
+
+double WordProposal::FixedBytes(int V, int K, double nnz, int limited) const {
+  // the smooth part and scratches
+  double bytes = K * (sizeof(AliasItem) + 4 * sizeof(double))
+                 * (1 + builders_);
+  bytes += (double)V * sizeof(Buffer) * (builders_ > 0 ? 2 : 1);
+  if (limited) {
+    // the LRU list
+    bytes += (V + 1.0) * 2 * sizeof(int);
+  }
+  if (builders_ > 0) {
+    // states and the snapshot
+    bytes += V * sizeof(int) + (V + 1.0) * sizeof(int)
+             + nnz * 2 * sizeof(int)
+             + K * (sizeof(TokenIndex) + sizeof(double));
+  }
+  return bytes;
+}
+
+void WordProposal::Init(const IntTables* words_topics_count,
+                        const TokenDenseTable* topics_count,
+                        const std::vector<double>* weights,
+                        const double* hp_beta,
+                        const double* hp_sum_beta,
+                        const Corpus* corpus,
+                        int V,
+                        int K,
+                        int samples) {
+  words_topics_count_ = words_topics_count;
+  topics_count_ = topics_count;
+  weights_ = weights;
+  hp_beta_ = hp_beta;
+  hp_sum_beta_ = hp_sum_beta;
+  corpus_ = corpus;
+  V_ = V;
+  K_ = K;
+  samples_ = samples;
+
+  smooth_pdf_.resize(K_);
+  fronts_.clear();
+  fronts_.resize(V_);
+  items_ = 0;
+
+  if (memory_limit_ > 0) {
+    const double max_items = memory_limit_ * 1048576.0 / kItemSize;
+    if (max_items > 2147483647.0) {
+      max_items_ = 2147483647;
+    } else {
+      max_items_ = (int)max_items;
+    }
+    lru_prev_.assign(V_ + 1, -1);
+    lru_next_.assign(V_ + 1, -1);
+    lru_prev_[V_] = V_;
+    lru_next_[V_] = V_;
+    Log("Caching word proposals in %dMB.\n", memory_limit_);
+  } else {
+    max_items_ = 0;
+  }
+
+  if (builders_ > 0) {
+    backs_.clear();
+    backs_.resize(V_);
+    states_.assign(V_, kEmpty);
+    builder_scratches_.resize(builders_);
+    Log("Building word proposals with %d threads.\n", builders_);
+  }
+}
+
+void WordProposal::BeginIteration() {
+  requests_ = 0;
+  inline_builds_ = 0;
+  handovers_ = 0;
+  evictions_ = 0;
+
+  const double hp_beta = *hp_beta_;
+  const double hp_sum_beta = *hp_sum_beta_;
+  int k;
+  smooth_sum_ = 0.0;
+  for (k = 0; k < K_; k++) {
+    double& pdf = smooth_pdf_[k];
+    pdf = hp_beta / ((*topics_count_)[k] + hp_sum_beta);
+    if (weights_) {
+      pdf *= (*weights_)[k];
+    }
+    smooth_sum_ += pdf;
+  }
+  smooth_alias_.Build(smooth_pdf_, smooth_sum_);
+
+  if (builders_ == 0) {
+    return;
+  }
+
+  snapshot_offsets_.resize(V_ + 1);
+  snapshot_offsets_[0] = 0;
+  snapshot_topics_.clear();
+  snapshot_counts_.clear();
+  for (int v = 0; v < V_; v++) {
+    const IntTable& word_v_topics_count = (*words_topics_count_)[v];
+    IntTable::const_iterator first = word_v_topics_count.begin();
+    IntTable::const_iterator last = word_v_topics_count.end();
+    for (; first != last; ++first) {
+      if (first.count()) {
+        snapshot_topics_.push_back(first.id());
+        snapshot_counts_.push_back(first.count());
+      }
+    }
+    snapshot_offsets_[v + 1] = (int)snapshot_topics_.size();
+  }
+  snapshot_topics_count_.resize(K_);
+  for (k = 0; k < K_; k++) {
+    snapshot_topics_count_[k] = (*topics_count_)[k];
+  }
+  if (weights_) {
+    snapshot_weights_ = *weights_;
+  }
+  snapshot_sum_beta_ = hp_sum_beta;
+
+  progress_ = 0;
+  cursor_ = 0;
+  stop_ = 0;
+}
+
+void WordProposal::Advance(int m) {
+  AtomicStore(&progress_, m);
+}
+
+void WordProposal::EndIteration() {
+  if (builders_ == 0 && max_items_ == 0) {
+    return;
+  }
+  AtomicStore(&stop_, 1);
+  const double hit_rate = requests_
+                          ? 100.0 * (requests_ - inline_builds_) / requests_
+                          : 0.0;
+  Log("Word proposals: %d requests, %.2lf%% hits, %d built inline,\n"
+      "  %d handed over by builders, %d evicted, %.1lfMB cached.\n",
+      requests_, hit_rate, inline_builds_, handovers_, evictions_,
+      AtomicLoad(&items_) * kItemSize / 1048576.0);
+}
+
+void WordProposal::RunBuilder(int i) {
+  Scratch* scratch = &builder_scratches_[i];
+  const std::vector<Doc>& docs = corpus_->docs;
+  const int M = (int)docs.size();
+  const double* weights = weights_ ? &snapshot_weights_[0] : NULL;
+
+  while (!AtomicLoad(&stop_)) {
+    const int cursor = AtomicLoad(&cursor_);
+    if (cursor >= M) {
+      break;
+    }
+
+    // skip docs the sampler has passed
+    const int progress = AtomicLoad(&progress_);
+    const int begin = std::max(cursor, progress);
+    if (docs[begin].index >= docs[progress].index + kLookahead) {
+      YieldThread();
+      continue;
+    }
+    int end = begin + 1;
+    int tokens = docs[begin].N;
+    while (end < M && tokens < kChunk) {
+      tokens += docs[end++].N;
+    }
+    if (!AtomicCompareExchange(&cursor_, cursor, end)) {
+      continue;
+    }
+
+    for (int m = begin; m < end; m++) {
+      const int* word = DocWords(docs, corpus_->words,
+                                 corpus_->compressed_words,
+                                 m, &scratch->doc_words);
+      for (int n = 0; n < docs[m].N; n++) {
+        const int v = word[n];
+        if (max_items_ && AtomicLoad(&items_) >= max_items_) {
+          break;
+        }
+        if (AtomicLoad(&states_[v]) != kEmpty
+            || !AtomicCompareExchange(&states_[v], kEmpty, kBuilding)) {
+          continue;
+        }
+
+        scratch->topics.clear();
+        scratch->counts.clear();
+        scratch->topics_count.clear();
+        for (int l = snapshot_offsets_[v]; l < snapshot_offsets_[v + 1]; l++) {
+          const int k = snapshot_topics_[l];
+          scratch->topics.push_back(k);
+          scratch->counts.push_back(snapshot_counts_[l]);
+          scratch->topics_count.push_back(snapshot_topics_count_[k]);
+        }
+        Buffer& back = backs_[v];
+        Fill(weights, snapshot_sum_beta_, scratch, &back);
+        AtomicFetchAdd(&items_, Items(back));
+        AtomicStore(&states_[v], kReady);
+      }
+    }
+  }
+}
+
+void WordProposal::Refill(int v, Buffer* front) {
+  if (builders_ > 0 && AtomicLoad(&states_[v]) == kReady) {
+    Buffer& back = backs_[v];
+    AtomicFetchAdd(&items_, -Items(*front));
+    front->table.swap(back.table);
+    front->topics.swap(back.topics);
+    front->sum = back.sum;
+    front->draws = back.draws;
+    Free(&back);
+    AtomicStore(&states_[v], kEmpty);
+    handovers_++;
+    if (max_items_) {
+      Touch(v);
+    }
+    return;
+  }
+
+  scratch_.topics.clear();
+  scratch_.counts.clear();
+  scratch_.topics_count.clear();
+  const IntTable& word_v_topics_count = (*words_topics_count_)[v];
+  IntTable::const_iterator first = word_v_topics_count.begin();
+  IntTable::const_iterator last = word_v_topics_count.end();
+  for (; first != last; ++first) {
+    if (first.count()) {
+      const int k = first.id();
+      scratch_.topics.push_back(k);
+      scratch_.counts.push_back(first.count());
+      scratch_.topics_count.push_back((*topics_count_)[k]);
+    }
+  }
+
+  const int old_items = Items(*front);
+  Fill(weights_ ? &(*weights_)[0] : NULL, *hp_sum_beta_, &scratch_, front);
+  AtomicFetchAdd(&items_, Items(*front) - old_items);
+  inline_builds_++;
+  if (max_items_) {
+    Touch(v);
+    Evict(v);
+  }
+}
+
+void WordProposal::Touch(int v) {
+  int& prev = lru_prev_[v];
+  int& next = lru_next_[v];
+  if (prev != -1) {
+    lru_next_[prev] = next;
+    lru_prev_[next] = prev;
+  }
+  prev = V_;
+  next = lru_next_[V_];
+  lru_prev_[next] = v;
+  lru_next_[V_] = v;
+}
+
+void WordProposal::Evict(int v) {
+  while (AtomicLoad(&items_) > max_items_) {
+    const int u = lru_prev_[V_];
+    if (u == v || u == V_) {
+      break;
+    }
+    lru_next_[lru_prev_[u]] = V_;
+    lru_prev_[V_] = lru_prev_[u];
+    lru_prev_[u] = -1;
+    lru_next_[u] = -1;
+    AtomicFetchAdd(&items_, -Items(fronts_[u]));
+    Free(&fronts_[u]);
+    evictions_++;
+  }
+}
+
+void WordProposal::Fill(const double* weights, double sum_beta,
+                        Scratch* scratch, Buffer* buffer) const {
+  const int nnz = (int)scratch->topics.size();
+  std::vector<double>& pdf = scratch->pdf;
+  double sum = 0.0;
+  pdf.resize(nnz);
+  for (int i = 0; i < nnz; i++) {
+    const int k = scratch->topics[i];
+    pdf[i] = scratch->counts[i] / (scratch->topics_count[i] + sum_beta);
+    if (weights) {
+      pdf[i] *= weights[k];
+    }
+    sum += pdf[i];
+  }
+
+  buffer->topics = scratch->topics;
+  buffer->table.resize(nnz);
+  if (nnz) {
+    scratch->alias.Build(&pdf[0], nnz, sum, &buffer->table[0]);
+  }
+  buffer->sum = sum;
+  buffer->draws = samples_;
+}
@@ -0,0 +1,227 @@
+// Copyright (c) 2015 Tencent Inc.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// the word proposal of AliasLDA and LightLDA
+//
+
+#ifndef SRC_LDA_WORD_PROPOSAL_H_
+#define SRC_LDA_WORD_PROPOSAL_H_
+
+#include <vector>
+#include "lda/alias.h"
+#include "lda/array.h"
+#include "lda/corpus.h"
+#include "lda/rand.h"
+
+// The word proposal of word v is
+//   q_v(k) = w_k * N_vk / (N_k + sum_beta)  [sparse part]
+//          + w_k * beta / (N_k + sum_beta)  [smooth part]
+// where w_k is alpha_k for AliasLDA and 1 for LightLDA.
+// The sparse part of each word is an alias table over its nonzero topics,
+// which is rebuilt in O(nnz) after "samples" draws.
+// The smooth part is shared by all words,
+// it is an alias table over all topics rebuilt once an iteration.
+//
+// Each word has a front buffer used by the sampler.
+// When it runs out, the sampler rebuilds it inline,
+// unless builders have prepared a back buffer for it.
+// Builders are background threads looking ahead in the token stream,
+// they fill back buffers of upcoming words
+// from a snapshot of the counts taken at the beginning of an iteration,
+// and hand them over by an atomic state of each word without any lock.
+//
+// Buffers may be bounded by a memory budget,
+// in which case front buffers of the least recently used words are freed,
+// and rebuilt when those words show up again.
+class WordProposal {
+ private:
+  struct Buffer {
+    std::vector<AliasItem> table;
+    std::vector<int> topics;  // topics[i]: topic of "table[i]"
+    double sum;  // normalizer of the sparse part
+    int draws;  // # of draws left before a rebuild
+    Buffer() : sum(0.0), draws(0) {}
+  };
+
+  // states of back buffers
+  enum {
+    kEmpty = 0,
+    kBuilding,
+    kReady
+  };
+
+  struct Scratch {
+    Alias alias;
+    std::vector<double> pdf;
+    // (topic, N_vk, N_k) of nonzero topics of a word
+    std::vector<int> topics;
+    std::vector<int> counts;
+    std::vector<TokenIndex> topics_count;
+    std::vector<int> doc_words;  // buffer of "DocWords"
+  };
+
+  // the sampler's model, read only
+  const IntTables* words_topics_count_;
+  const TokenDenseTable* topics_count_;
+  const std::vector<double>* weights_;  // w_k, NULL means 1
+  const double* hp_beta_;
+  const double* hp_sum_beta_;
+  const Corpus* corpus_;
+  int V_;
+  int K_;
+  int samples_;  // # of draws from a build
+
+  // the smooth part
+  Alias smooth_alias_;
+  std::vector<double> smooth_pdf_;
+  double smooth_sum_;
+
+  std::vector<Buffer> fronts_;
+  std::vector<Buffer> backs_;
+  std::vector<int> states_;  // states_[v]: state of "backs_[v]"
+  Scratch scratch_;
+
+  // memory budget
+  int memory_limit_;  // in MB, 0 is unlimited
+  int max_items_;  // 0 is unlimited
+  volatile int items_;  // # of allocated items of all buffers
+  // LRU list of words with a front buffer,
+  // "V_" is the head and the tail, -1 means not in the list.
+  std::vector<int> lru_prev_;
+  std::vector<int> lru_next_;
+
+  // statistics of an iteration
+  int requests_;
+  int inline_builds_;
+  int handovers_;
+  int evictions_;
+
+  // builders
+  int builders_;
+  std::vector<Scratch> builder_scratches_;
+  volatile int progress_;  // the doc being sampled
+  volatile int cursor_;  // next doc to be claimed by builders
+  volatile int stop_;
+  // snapshot of the model in CSR
+  std::vector<int> snapshot_offsets_;
+  std::vector<int> snapshot_topics_;
+  std::vector<int> snapshot_counts_;
+  std::vector<TokenIndex> snapshot_topics_count_;
+  std::vector<double> snapshot_weights_;
+  double snapshot_sum_beta_;
+
+ public:
+  WordProposal() : words_topics_count_(NULL),
+    topics_count_(NULL),
+    weights_(NULL),
+    hp_beta_(NULL),
+    hp_sum_beta_(NULL),
+    corpus_(NULL),
+    V_(0),
+    K_(0),
+    samples_(0),
+    smooth_sum_(0.0),
+    memory_limit_(0),
+    max_items_(0),
+    items_(0),
+    requests_(0),
+    inline_builds_(0),
+    handovers_(0),
+    evictions_(0),
+    builders_(0),
+    progress_(0),
+    cursor_(0),
+    stop_(0),
+    snapshot_sum_beta_(0.0) {}
+
+  // setters
+  int& builders() {
+    return builders_;
+  }
+
+  int& memory_limit() {
+    return memory_limit_;
+  }
+  // end of setters
+
+  // estimated peak bytes of "V" words whose nonzero topics are "nnz" in all,
+  // with the budget "memory_limit" if any, for planning memory before "Init"
+  double EstimateBytes(int V, int K, double nnz) const;
+  // set "memory_limit" so that "EstimateBytes" is within "bytes",
+  // return -1 if it is impossible
+  int LimitBytes(int V, int K, double nnz, double bytes);
+
+  void Init(const IntTables* words_topics_count,
+            const TokenDenseTable* topics_count,
+            const std::vector<double>* weights,
+            const double* hp_beta,
+            const double* hp_sum_beta,
+            const Corpus* corpus,
+            int V,
+            int K,
+            int samples);
+
+  // make sure word v has at least "need" draws left,
+  // return the normalizer of q_v
+  double Prepare(int v, int need) {
+    Buffer* front = &fronts_[v];
+    requests_++;
+    if (front->draws < need) {
+      Refill(v, front);
+    } else if (max_items_) {
+      Touch(v);
+    }
+    return front->sum + smooth_sum_;
+  }
+
+  // draw from q_v, after "Prepare"
+  int Sample(int v) {
+    Buffer* front = &fronts_[v];
+    front->draws--;
+    const double sample = Rand::Double01() * (front->sum + smooth_sum_);
+    if (sample < front->sum) {
+      const int i = Alias::Sample(&front->table[0], (int)front->table.size(),
+                                  sample / front->sum);
+      return front->topics[i];
+    }
+    double u = (sample - front->sum) / smooth_sum_;
+    if (u >= 1.0) {
+      // rare numerical errors may lie in this branch
+      u = 0.0;
+    }
+    return smooth_alias_.Sample(u);
+  }
+
+  // interfaces with builders, all but "RunBuilder" are for the sampler.
+  // The sampler loops documents between "BeginIteration" and "EndIteration"
+  // and calls "Advance(m)" at the beginning of doc m,
+  // while builder i runs "RunBuilder(i)" in the same time.
+  void BeginIteration();
+  void Advance(int m);
+  void EndIteration();
+  void RunBuilder(int i);
+
+ private:
+  // estimated bytes except items of buffers
+  double FixedBytes(int V, int K, double nnz, int limited) const;
+  void Refill(int v, Buffer* front);
+  // move word v to the head of the LRU list
+  void Touch(int v);
+  // free front buffers from the tail of the LRU list until within budget,
+  // word v is kept
+  void Evict(int v);
+  // build the sparse part from "scratch"
+  void Fill(const double* weights, double sum_beta,
+            Scratch* scratch, Buffer* buffer) const;
+  static int Items(const Buffer& buffer) {
+    return (int)buffer.topics.capacity();
+  }
+  static void Free(Buffer* buffer) {
+    std::vector<AliasItem>().swap(buffer->table);
+    std::vector<int>().swap(buffer->topics);
+    buffer->sum = 0.0;
+    buffer->draws = 0;
+  }
+};
+
+#endif  // SRC_LDA_WORD_PROPOSAL_H_